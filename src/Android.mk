@@ -4,8 +4,8 @@ include $(CLEAR_VARS)
 
 LOCAL_MODULE    := stockfish
 LOCAL_SRC_FILES := \
-	benchmark.cpp	book.cpp	evaluate.cpp	misc.cpp	notation.cpp	search.cpp	tt.cpp \
-	bitbase.cpp	dgt.cpp  dgtnix.c		main.cpp	movegen.cpp	pawns.cpp	thread.cpp	uci.cpp \
+	benchmark.cpp	book.cpp	evaluate.cpp	misc.cpp	notation.cpp	perft.cpp	search.cpp	tt.cpp \
+	bitbase.cpp	dgt.cpp  dgtgame.cpp	dgtnix.c	dgtpgn.cpp	dgttrace.cpp		main.cpp	movegen.cpp	pawns.cpp	thread.cpp	uci.cpp \
 	bitboard.cpp	endgame.cpp	material.cpp	movepick.cpp	position.cpp	timeman.cpp	ucioption.cpp
 
 LOCAL_CFLAGS    := -I$(ANDROID_NDK)/sources/cxx-stl/stlport/stlport \
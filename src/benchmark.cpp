@@ -23,6 +23,7 @@
 #include <vector>
 
 #include "misc.h"
+#include "perft.h"
 #include "position.h"
 #include "search.h"
 #include "thread.h"
@@ -124,7 +125,7 @@ void benchmark(const Position& current, istream& is) {
 
       if (limitType == "perft")
       {
-          size_t cnt = Search::perft(pos, limits.depth * ONE_PLY);
+          uint64_t cnt = Perft::perft(pos, limits.depth);
           cerr << "\nPerft " << limits.depth  << " leaf nodes: " << cnt << endl;
           nodes += cnt;
       }
@@ -17,7 +17,10 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
 #include <cassert>
+#include <fstream>
+#include <iomanip>
 #include <vector>
 
 #include "bitboard.h"
@@ -28,8 +31,12 @@ namespace {
   // The possible pawns squares are 24, the first 4 files and ranks from 2 to 7
   const unsigned IndexMax = 2*24*64*64; // stm * psq * wksq * bksq = 196608
 
-  // Each uint32_t stores results of 32 positions, one per bit
-  uint32_t KPKBitbase[IndexMax / 32];
+  // Each uint32_t stores results of 32 positions, one per bit. The bitbase is
+  // computed once by generate() and embedded, so that it is not recomputed at
+  // every startup. Run 'make kpk-bitbase' to rebuild kpkbitbase.h.
+  const uint32_t KPKBitbase[IndexMax / 32] = {
+#include "kpkbitbase.h"
+  };
 
   // A KPK bitbase index is an integer in [0, IndexMax] range
   //
@@ -68,6 +75,8 @@ namespace {
     Result res;
   };
 
+  void generate(uint32_t bitbase[]);
+
 } // namespace
 
 
@@ -80,31 +89,66 @@ bool Bitbases::probe_kpk(Square wksq, Square wpsq, Square bksq, Color us) {
 }
 
 
+/// Bitbases::init_kpk() checks in debug builds that the embedded bitbase is
+/// the one computed by the retrograde analysis.
+
 void Bitbases::init_kpk() {
 
-  unsigned idx, repeat = 1;
-  std::vector<KPKPosition> db(IndexMax);
+#ifndef NDEBUG
+  std::vector<uint32_t> bitbase(IndexMax / 32);
+  generate(&bitbase[0]);
+  assert(std::equal(bitbase.begin(), bitbase.end(), KPKBitbase));
+#endif
+}
+
+
+/// Bitbases::write_kpk() computes the bitbase and writes it to the given file,
+/// in the format of kpkbitbase.h.
+
+bool Bitbases::write_kpk(const std::string& fileName) {
+
+  std::vector<uint32_t> bitbase(IndexMax / 32);
+  generate(&bitbase[0]);
 
-  // Initialize db with known win / draw positions
-  for (idx = 0; idx < IndexMax; idx++)
-      db[idx].classify_leaf(idx);
+  std::ofstream file(fileName.c_str());
+  file << "// KPK bitbase, generated by the 'kpk' command of Stockfish. Do not edit.\n"
+       << std::hex << std::uppercase << std::setfill('0');
 
-  // Iterate through the positions until no more of the unknown positions can be
-  // changed to either wins or draws (15 cycles needed).
-  while (repeat)
-      for (repeat = idx = 0; idx < IndexMax; idx++)
-          if (db[idx] == UNKNOWN && db[idx].classify(db) != UNKNOWN)
-              repeat = 1;
+  for (unsigned i = 0; i < bitbase.size(); i++)
+      file << "0x" << std::setw(8) << bitbase[i] << (i % 8 == 7 ? ",\n" : ", ");
 
-  // Map 32 results into one KPKBitbase[] entry
-  for (idx = 0; idx < IndexMax; idx++)
-      if (db[idx] == WIN)
-          KPKBitbase[idx / 32] |= 1 << (idx & 0x1F);
+  return file.good();
 }
 
 
 namespace {
 
+  // generate() classifies all the KPK positions by retrograde analysis and
+  // stores the wins in the given bitbase, that must be zeroed.
+
+  void generate(uint32_t bitbase[]) {
+
+    unsigned idx, repeat = 1;
+    std::vector<KPKPosition> db(IndexMax);
+
+    // Initialize db with known win / draw positions
+    for (idx = 0; idx < IndexMax; idx++)
+        db[idx].classify_leaf(idx);
+
+    // Iterate through the positions until no more of the unknown positions can be
+    // changed to either wins or draws (15 cycles needed).
+    while (repeat)
+        for (repeat = idx = 0; idx < IndexMax; idx++)
+            if (db[idx] == UNKNOWN && db[idx].classify(db) != UNKNOWN)
+                repeat = 1;
+
+    // Map 32 results into one bitbase[] entry
+    for (idx = 0; idx < IndexMax; idx++)
+        if (db[idx] == WIN)
+            bitbase[idx / 32] |= 1 << (idx & 0x1F);
+  }
+
+
   Result KPKPosition::classify_leaf(unsigned idx) {
 
     wksq = Square((idx >>  0) & 0x3F);
@@ -18,13 +18,19 @@
 */
 
 #include <algorithm>
-#include <cstring>
 #include <iostream>
 
 #include "bitboard.h"
 #include "bitcount.h"
 #include "misc.h"
-#include "rkiss.h"
+
+#ifdef USE_CPUID
+#  if defined(_MSC_VER)
+#    include <intrin.h>
+#  else
+#    include <cpuid.h>
+#  endif
+#endif
 
 CACHE_LINE_ALIGNMENT
 
@@ -44,14 +50,18 @@ Bitboard RankBB[RANK_NB];
 Bitboard AdjacentFilesBB[FILE_NB];
 Bitboard InFrontBB[COLOR_NB][RANK_NB];
 Bitboard StepAttacksBB[PIECE_NB][SQUARE_NB];
-Bitboard BetweenBB[SQUARE_NB][SQUARE_NB];
-Bitboard DistanceRingsBB[SQUARE_NB][8];
 Bitboard ForwardBB[COLOR_NB][SQUARE_NB];
 Bitboard PassedPawnMask[COLOR_NB][SQUARE_NB];
 Bitboard PawnAttackSpan[COLOR_NB][SQUARE_NB];
 Bitboard PseudoAttacks[PIECE_TYPE_NB][SQUARE_NB];
 
+#ifdef COMPACT_TABLES
+uint8_t SquareDistance[SQUARE_NB][SQUARE_NB];
+#else
+Bitboard BetweenBB[SQUARE_NB][SQUARE_NB];
+Bitboard DistanceRingsBB[SQUARE_NB][8];
 int SquareDistance[SQUARE_NB][SQUARE_NB];
+#endif
 
 namespace {
 
@@ -66,10 +76,93 @@ namespace {
   Bitboard RTable[0x19000]; // Storage space for rook attacks
   Bitboard BTable[0x1480];  // Storage space for bishop attacks
 
+  // Magic numbers for the rook and bishop attack tables, for the 32-bit and the
+  // 64-bit index computations. They were found once by a random search and
+  // are checked by init_magics() in debug builds.
+  const Bitboard RookMagics[][SQUARE_NB] = {
+  {
+    0x8840800800101121ULL, 0x003E004020400020ULL, 0x8230420044010084ULL, 0x0008C01204008024ULL,
+    0x8041005084080834ULL, 0x0040029900400334ULL, 0x0101020000800083ULL, 0xA400208880200041ULL,
+    0x1000600004402030ULL, 0x40C0600000004010ULL, 0x4480122181408060ULL, 0x000A028001008030ULL,
+    0x2200906041022041ULL, 0x6008102020840104ULL, 0x0282508000008001ULL, 0x0006C00840088081ULL,
+    0x00C6219091900040ULL, 0x4A214008000C0808ULL, 0x100408C80140A020ULL, 0x0A49100000008808ULL,
+    0x0044009560420808ULL, 0x0041100200840042ULL, 0x0004012200904A02ULL, 0x1010468004C44101ULL,
+    0x2292284221025182ULL, 0x88354080800208C2ULL, 0x4082001919024422ULL, 0x4100100003400821ULL,
+    0x0100080080141015ULL, 0x2A2C001200000901ULL, 0x00120A110C8A9014ULL, 0x09C0410400000082ULL,
+    0x10404020006A408CULL, 0x0040005000082132ULL, 0x348010001100A020ULL, 0x0100082000401001ULL,
+    0x0410080044801004ULL, 0x9040060000004091ULL, 0x0100220A10400401ULL, 0x20801080080400C1ULL,
+    0x006480000C049040ULL, 0x50004002000C4020ULL, 0x0404080402024114ULL, 0x1001001822002089ULL,
+    0x2040408802080402ULL, 0x00804140968C8211ULL, 0x2008083000000322ULL, 0x001C808042900061ULL,
+    0x00400A8000022880ULL, 0x220128100BC00408ULL, 0x008640802002A010ULL, 0x0048034040001004ULL,
+    0x080840800081A004ULL, 0x000289000000201CULL, 0x04C0202004085601ULL, 0x4088430000144881ULL,
+    0x0300501290002492ULL, 0x00810C2120009040ULL, 0x488020164800084AULL, 0x1850000560407109ULL,
+    0x0100121104800428ULL, 0x080402010005280CULL, 0x410000D3024804AAULL, 0x4000244B51400081ULL
+  }, {
+    0x008000400020801AULL, 0x0840004020001003ULL, 0x8880200010018108ULL, 0x0480040800801001ULL,
+    0x0900080002050010ULL, 0x0200100804010200ULL, 0x0200010084080200ULL, 0x0200024100821224ULL,
+    0x08A0802080004000ULL, 0x0006401004402000ULL, 0x0800802000100080ULL, 0x4004800803100081ULL,
+    0x0106000810200600ULL, 0x2981000802040100ULL, 0x0004000804018210ULL, 0x0201000192026300ULL,
+    0x1038218000804000ULL, 0x1010004000200040ULL, 0x0108420012002881ULL, 0x2098008008100080ULL,
+    0x4088010004090010ULL, 0x2000808002000400ULL, 0x028A0C0008021025ULL, 0x0000220000810064ULL,
+    0x0040400480208000ULL, 0x8040200040100042ULL, 0x2000100080802000ULL, 0x3090004040080401ULL,
+    0x0100080080800400ULL, 0x8230020080800400ULL, 0x0002000200080104ULL, 0x0C00010200004084ULL,
+    0x0000400082800020ULL, 0x0400200080804007ULL, 0x8400801000802001ULL, 0x0018100080800800ULL,
+    0x0810310005004800ULL, 0x8000020080800400ULL, 0x2000302134000208ULL, 0x0000298402000645ULL,
+    0x0000800140018022ULL, 0x00184020100C4000ULL, 0x6210002804002000ULL, 0x0001000C10010020ULL,
+    0x4201000800110004ULL, 0x2002000810020004ULL, 0xA40C21480A040090ULL, 0x0000004081020004ULL,
+    0x3302410080002300ULL, 0x9210002000401040ULL, 0x0092110041200300ULL, 0x0100100109002300ULL,
+    0x000A800800240280ULL, 0x0100040080020080ULL, 0x0000506201080400ULL, 0x1002209110440600ULL,
+    0x0140800300182241ULL, 0x8280184280220102ULL, 0x0005118042000A22ULL, 0x008A000890204006ULL,
+    0x000200304844204AULL, 0x108200080930041AULL, 0x0482000100840842ULL, 0x0012192404430182ULL
+  } };
+
+  const Bitboard BishopMagics[][SQUARE_NB] = {
+  {
+    0x2090A20001220404ULL, 0x0280510A00031802ULL, 0x804010420C240404ULL, 0x0000241080181491ULL,
+    0x00004840C0040420ULL, 0x0640802101291088ULL, 0x08088023885400ACULL, 0x0160022200808611ULL,
+    0x2104440060025045ULL, 0x0B0C511104020244ULL, 0x01A024A818400808ULL, 0x2080611100420504ULL,
+    0x1000240414080242ULL, 0x0220001150000282ULL, 0x480A40C003D02041ULL, 0x0822030100402282ULL,
+    0x30220A9004100022ULL, 0x3001005410300888ULL, 0x2028A02060300009ULL, 0x2102600030009201ULL,
+    0x142008248100940CULL, 0x00C602000001050AULL, 0x009010C042108001ULL, 0x0088040940582009ULL,
+    0x2804410045884000ULL, 0x0848090008452101ULL, 0x04240450202C0214ULL, 0x8082040400140401ULL,
+    0x0C81005890804040ULL, 0x0070108000021080ULL, 0x00A8210010050140ULL, 0x0104481020133048ULL,
+    0x080C705008080809ULL, 0x000E100000040148ULL, 0x1004284000050028ULL, 0x0084054000800208ULL,
+    0x8240110004240424ULL, 0x01610481000600C2ULL, 0x8283012142214842ULL, 0x8080610001090401ULL,
+    0x09184000600E4909ULL, 0x0440020813054412ULL, 0x0404880028201A68ULL, 0x080400808800084AULL,
+    0x10158B8094091089ULL, 0x01210200000218A8ULL, 0x0040CC08000C2882ULL, 0x0044012241124202ULL,
+    0x2006000080908405ULL, 0x0C06010001444402ULL, 0x40B0000060084241ULL, 0x4082110350121421ULL,
+    0x20C100600A0A0060ULL, 0x04043002000808E0ULL, 0x01620A2008B02001ULL, 0x0501080085080701ULL,
+    0x00900A0005020242ULL, 0x04124800A4200824ULL, 0x0090C40901050485ULL, 0x11421206000C0101ULL,
+    0x1450440081092200ULL, 0x05080080000002E4ULL, 0x1102020400D02E04ULL, 0x0450A02010400464ULL
+  }, {
+    0x4404700420508600ULL, 0x9120018401104008ULL, 0x4004010401100084ULL, 0x0051040080062000ULL,
+    0x1124042010010092ULL, 0x1100882108001000ULL, 0x180A280248040000ULL, 0x0038440210900400ULL,
+    0x80074210E1010301ULL, 0x0020101012004E42ULL, 0x8210100110411001ULL, 0x00008404108010A0ULL,
+    0x2060071040002804ULL, 0x6400020202211011ULL, 0x000C0D0111202000ULL, 0x8004050118020221ULL,
+    0x8005804088080910ULL, 0x6004A82001020200ULL, 0x0101001004002041ULL, 0x8A1800A082004282ULL,
+    0x8806001012100098ULL, 0x0022810040504000ULL, 0x4040800048480801ULL, 0x0A42041304824120ULL,
+    0x0204106085200814ULL, 0x0890110682040111ULL, 0x4000500001040080ULL, 0x0000808018020102ULL,
+    0x2401010010104008ULL, 0x1052008004100080ULL, 0x0000950104090801ULL, 0x1200808000220864ULL,
+    0x8188421201082050ULL, 0x0035011001A05C00ULL, 0x0051480201104400ULL, 0x4110040400180210ULL,
+    0x0414140400001100ULL, 0x4E60008100688040ULL, 0x000121022AC40200ULL, 0x00040042904A0094ULL,
+    0x2948010421001040ULL, 0x4060821011020200ULL, 0x0001004030008202ULL, 0x0018020122080401ULL,
+    0x0042CA41A2000400ULL, 0x01C0212040810100ULL, 0x1060480F41020041ULL, 0x020102020A040040ULL,
+    0x1082008220100402ULL, 0x0102020202828102ULL, 0x4022108848080004ULL, 0x0020400508480000ULL,
+    0x1010108590440010ULL, 0xD812040810A10140ULL, 0x0191043000A20038ULL, 0x8010020200620000ULL,
+    0x0001008801084280ULL, 0x0000060882015050ULL, 0x8120000100809001ULL, 0x0200100002104420ULL,
+    0x10D100200821010AULL, 0x03002C0448100110ULL, 0x14004005045C0042ULL, 0x4002901008831040ULL
+  } };
+
+  Square RDeltas[] = { DELTA_N,  DELTA_E,  DELTA_S,  DELTA_W  };
+  Square BDeltas[] = { DELTA_NE, DELTA_SE, DELTA_SW, DELTA_NW };
+
   typedef unsigned (Fn)(Square, Bitboard);
 
+  Bitboard sliding_attack(Square deltas[], Square sq, Bitboard occupied);
   void init_magics(Bitboard table[], Bitboard* attacks[], Bitboard magics[],
-                   Bitboard masks[], unsigned shifts[], Square deltas[], Fn index);
+                   const Bitboard knownMagics[], Bitboard masks[], unsigned shifts[],
+                   Square deltas[]);
+  void init_attacks(Bitboard* attacks[], Bitboard masks[], Square deltas[], Square s, Fn index);
 
   FORCE_INLINE unsigned bsf_index(Bitboard b) {
 
@@ -78,8 +171,57 @@ namespace {
     return Is64Bit ? (b * DeBruijn_64) >> 58
                    : ((unsigned(b) ^ unsigned(b >> 32)) * DeBruijn_32) >> 26;
   }
+
+#ifdef USE_CPUID
+
+  // cpuid() fills regs with the eax, ebx, ecx and edx values of the given leaf
+  void cpuid(unsigned leaf, unsigned regs[4]) {
+
+#  if defined(_MSC_VER)
+    __cpuidex((int*)regs, leaf, 0);
+#  else
+    __cpuid_count(leaf, 0, regs[0], regs[1], regs[2], regs[3]);
+#  endif
+  }
+
+  bool cpu_has_popcnt() {
+
+    unsigned regs[4];
+    cpuid(0, regs);
+    if (regs[0] < 1)
+        return false;
+
+    cpuid(1, regs);
+    return regs[2] & (1 << 23);
+  }
+
+  // AMD CPUs before Zen 3 (family 19h) run pext in microcode, much slower than
+  // a magic multiplication, so we use pext only if it is done in hardware.
+  bool cpu_has_fast_pext() {
+
+    unsigned regs[4];
+    cpuid(0, regs);
+    bool amd = regs[1] == 0x68747541; // "Auth" of "AuthenticAMD"
+    if (regs[0] < 7)
+        return false;
+
+    cpuid(1, regs);
+    unsigned family = (regs[0] >> 8) & 0xF;
+    if (family == 0xF)
+        family += (regs[0] >> 20) & 0xFF;
+
+    cpuid(7, regs);
+    return (regs[1] & (1 << 8)) && !(amd && family < 0x19);
+  }
+
+#endif
 }
 
+#ifdef USE_CPUID
+bool UsePopCnt = HasPopCnt || cpu_has_popcnt();
+bool UsePext = cpu_has_fast_pext();
+#endif
+
 /// lsb()/msb() finds the least/most significant bit in a nonzero bitboard.
 /// pop_lsb() finds and clears the least significant bit in a nonzero bitboard.
 
@@ -145,11 +287,22 @@ void Bitboards::print(Bitboard b) {
 }
 
 
-/// Bitboards::init() initializes various bitboard arrays. It is called during
+/// Bitboards::init() initializes all the bitboard arrays. It is called during
 /// program initialization.
 
 void Bitboards::init() {
 
+  init_tables();
+  init_sliders(SQ_A1, SQ_H8);
+}
+
+
+/// Bitboards::init_tables() initializes the bitboard arrays but the attack
+/// tables of the sliding pieces, filled by init_sliders(). Startup can fill
+/// them on several threads at once, each one with its own range of squares.
+
+void Bitboards::init_tables() {
+
   for (int k = 0, i = 0; i < 8; i++)
       while (k < (2 << i))
           MS1BTable[k++] = i;
@@ -187,8 +340,10 @@ void Bitboards::init() {
       for (Square s2 = SQ_A1; s2 <= SQ_H8; s2++)
       {
           SquareDistance[s1][s2] = std::max(file_distance(s1, s2), rank_distance(s1, s2));
+#ifndef COMPACT_TABLES
           if (s1 != s2)
              DistanceRingsBB[s1][SquareDistance[s1][s2] - 1] |= s2;
+#endif
       }
 
   int steps[][9] = { {}, { 7, 9 }, { 17, 15, 10, 6, -6, -10, -15, -17 },
@@ -205,18 +360,16 @@ void Bitboards::init() {
                       StepAttacksBB[make_piece(c, pt)][s] |= to;
               }
 
-  Square RDeltas[] = { DELTA_N,  DELTA_E,  DELTA_S,  DELTA_W  };
-  Square BDeltas[] = { DELTA_NE, DELTA_SE, DELTA_SW, DELTA_NW };
-
-  init_magics(RTable, RAttacks, RMagics, RMasks, RShifts, RDeltas, magic_index<ROOK>);
-  init_magics(BTable, BAttacks, BMagics, BMasks, BShifts, BDeltas, magic_index<BISHOP>);
+  init_magics(RTable, RAttacks, RMagics, RookMagics[Is64Bit], RMasks, RShifts, RDeltas);
+  init_magics(BTable, BAttacks, BMagics, BishopMagics[Is64Bit], BMasks, BShifts, BDeltas);
 
   for (Square s = SQ_A1; s <= SQ_H8; s++)
   {
-      PseudoAttacks[QUEEN][s]  = PseudoAttacks[BISHOP][s] = attacks_bb<BISHOP>(s, 0);
-      PseudoAttacks[QUEEN][s] |= PseudoAttacks[  ROOK][s] = attacks_bb<  ROOK>(s, 0);
+      PseudoAttacks[QUEEN][s]  = PseudoAttacks[BISHOP][s] = sliding_attack(BDeltas, s, 0);
+      PseudoAttacks[QUEEN][s] |= PseudoAttacks[  ROOK][s] = sliding_attack(RDeltas, s, 0);
   }
 
+#ifndef COMPACT_TABLES
   for (Square s1 = SQ_A1; s1 <= SQ_H8; s1++)
       for (Square s2 = SQ_A1; s2 <= SQ_H8; s2++)
           if (PseudoAttacks[QUEEN][s1] & s2)
@@ -226,6 +379,20 @@ void Bitboards::init() {
               for (Square s = s1 + delta; s != s2; s += delta)
                   BetweenBB[s1][s2] |= s;
           }
+#endif
+}
+
+
+/// Bitboards::init_sliders() fills the rook and bishop attacks of the squares
+/// from 'first' to 'last'. Must be called after init_tables().
+
+void Bitboards::init_sliders(Square first, Square last) {
+
+  for (Square s = first; s <= last; s++)
+  {
+      init_attacks(RAttacks, RMasks, RDeltas, s, magic_index<ROOK>);
+      init_attacks(BAttacks, BMasks, BDeltas, s, magic_index<BISHOP>);
+  }
 }
 
 
@@ -250,33 +417,17 @@ namespace {
   }
 
 
-  Bitboard pick_random(RKISS& rk, int booster) {
-
-    // Values s1 and s2 are used to rotate the candidate magic of a
-    // quantity known to be the optimal to quickly find the magics.
-    int s1 = booster & 63, s2 = (booster >> 6) & 63;
-
-    Bitboard m = rk.rand<Bitboard>();
-    m = (m >> s1) | (m << (64 - s1));
-    m &= rk.rand<Bitboard>();
-    m = (m >> s2) | (m << (64 - s2));
-    return m & rk.rand<Bitboard>();
-  }
-
-
-  // init_magics() computes all rook and bishop attacks at startup. Magic
+  // init_magics() computes the masks, the shifts and the magics of the rook or
+  // bishop attack tables, and where the table of each square starts. Magic
   // bitboards are used to look up attacks of sliding pieces. As a reference see
   // chessprogramming.wikispaces.com/Magic+Bitboards. In particular, here we
-  // use the so called "fancy" approach.
+  // use the so called "fancy" approach, with known magics.
 
   void init_magics(Bitboard table[], Bitboard* attacks[], Bitboard magics[],
-                   Bitboard masks[], unsigned shifts[], Square deltas[], Fn index) {
+                   const Bitboard knownMagics[], Bitboard masks[], unsigned shifts[],
+                   Square deltas[]) {
 
-    int MagicBoosters[][8] = { { 3191, 2184, 1310, 3618, 2091, 1308, 2452, 3996 },
-                               { 1059, 3608,  605, 3234, 3326,   38, 2029, 3043 } };
-    RKISS rk;
-    Bitboard occupancy[4096], reference[4096], edges, b;
-    int i, size, booster;
+    Bitboard edges;
 
     // attacks[s] is a pointer to the beginning of the attacks table for square 's'
     attacks[SQ_A1] = table;
@@ -293,47 +444,33 @@ namespace {
         // apply to the 64 or 32 bits word to get the index.
         masks[s]  = sliding_attack(deltas, s, 0) & ~edges;
         shifts[s] = (Is64Bit ? 64 : 32) - popcount<Max15>(masks[s]);
-
-        // Use Carry-Rippler trick to enumerate all subsets of masks[s] and
-        // store the corresponding sliding attack bitboard in reference[].
-        b = size = 0;
-        do {
-            occupancy[size] = b;
-            reference[size++] = sliding_attack(deltas, s, b);
-            b = (b - masks[s]) & masks[s];
-        } while (b);
+        magics[s] = knownMagics[s];
 
         // Set the offset for the table of the next square. We have individual
         // table sizes for each square with "Fancy Magic Bitboards".
         if (s < SQ_H8)
-            attacks[s + 1] = attacks[s] + size;
+            attacks[s + 1] = attacks[s] + (1 << popcount<Max15>(masks[s]));
+    }
+  }
 
-        booster = MagicBoosters[Is64Bit][rank_of(s)];
 
-        // Find a magic for square 's' picking up an (almost) random number
-        // until we find the one that passes the verification test.
-        do {
-            do magics[s] = pick_random(rk, booster);
-            while (popcount<Max15>((magics[s] * masks[s]) >> 56) < 6);
+  // init_attacks() stores the sliding attacks of square 's' for every subset of
+  // its mask, enumerated with the Carry-Rippler trick, in the attacks[s] table.
 
-            std::memset(attacks[s], 0, size * sizeof(Bitboard));
+  void init_attacks(Bitboard* attacks[], Bitboard masks[], Square deltas[], Square s, Fn index) {
 
-            // A good magic must map every possible occupancy to an index that
-            // looks up the correct sliding attack in the attacks[s] database.
-            // Note that we build up the database for square 's' as a side
-            // effect of verifying the magic.
-            for (i = 0; i < size; i++)
-            {
-                Bitboard& attack = attacks[s][index(s, occupancy[i])];
+    Bitboard b = 0;
 
-                if (attack && attack != reference[i])
-                    break;
+    do {
+        Bitboard& attack = attacks[s][index(s, b)];
+        Bitboard reference = sliding_attack(deltas, s, b);
 
-                assert(reference[i] != 0);
+        // A good magic (or pext) maps every possible occupancy to an index
+        // that looks up the correct sliding attack.
+        assert(!attack || attack == reference);
 
-                attack = reference[i];
-            }
-        } while (i != size);
-    }
+        attack = reference;
+        b = (b - masks[s]) & masks[s];
+    } while (b);
   }
 }
@@ -21,11 +21,15 @@
 #ifndef BITBOARD_H_INCLUDED
 #define BITBOARD_H_INCLUDED
 
+#include <string>
+
 #include "types.h"
 
 namespace Bitboards {
 
 void init();
+void init_tables();
+void init_sliders(Square first, Square last);
 void print(Bitboard b);
 
 }
@@ -34,6 +38,7 @@ namespace Bitbases {
 
 void init_kpk();
 bool probe_kpk(Square wksq, Square wpsq, Square bksq, Color us);
+bool write_kpk(const std::string& fileName);
 
 }
 
@@ -73,14 +78,22 @@ extern Bitboard RankBB[RANK_NB];
 extern Bitboard AdjacentFilesBB[FILE_NB];
 extern Bitboard InFrontBB[COLOR_NB][RANK_NB];
 extern Bitboard StepAttacksBB[PIECE_NB][SQUARE_NB];
-extern Bitboard BetweenBB[SQUARE_NB][SQUARE_NB];
-extern Bitboard DistanceRingsBB[SQUARE_NB][8];
 extern Bitboard ForwardBB[COLOR_NB][SQUARE_NB];
 extern Bitboard PassedPawnMask[COLOR_NB][SQUARE_NB];
 extern Bitboard PawnAttackSpan[COLOR_NB][SQUARE_NB];
 extern Bitboard PseudoAttacks[PIECE_TYPE_NB][SQUARE_NB];
 
+#ifdef COMPACT_TABLES
+extern uint8_t SquareDistance[SQUARE_NB][SQUARE_NB];
+#else
+extern Bitboard BetweenBB[SQUARE_NB][SQUARE_NB];
+extern Bitboard DistanceRingsBB[SQUARE_NB][8];
 extern int SquareDistance[SQUARE_NB][SQUARE_NB];
+#endif
+
+#ifdef USE_CPUID
+extern bool UsePext; // Slider attacks are indexed with pext instead of magics
+#endif
 
 const Bitboard DarkSquares = 0xAA55AA55AA55AA55ULL;
 
@@ -177,10 +190,20 @@ inline Bitboard in_front_bb(Color c, Rank r) {
 /// between_bb() returns a bitboard representing all squares between two squares.
 /// For instance, between_bb(SQ_C4, SQ_F7) returns a bitboard with the bits for
 /// square d5 and e6 set.  If s1 and s2 are not on the same line, file or diagonal,
-/// 0 is returned.
+/// 0 is returned. With COMPACT_TABLES there is no 32KB table: the pseudo attacks
+/// of two aligned squares cross on the line joining them, that is then cut to
+/// the squares between the two.
 
 inline Bitboard between_bb(Square s1, Square s2) {
+#ifdef COMPACT_TABLES
+  PieceType pt = PseudoAttacks[ROOK][s1] & s2   ? ROOK
+               : PseudoAttacks[BISHOP][s1] & s2 ? BISHOP : NO_PIECE_TYPE;
+
+  return pt == NO_PIECE_TYPE ? 0 :  PseudoAttacks[pt][s1] & PseudoAttacks[pt][s2]
+                                 & ((~0ULL << s1) ^ (~0ULL << s2));
+#else
   return BetweenBB[s1][s2];
+#endif
 }
 
 
@@ -226,14 +249,34 @@ inline Bitboard squares_of_color(Square s) {
 /// either on a straight or on a diagonal line.
 
 inline bool squares_aligned(Square s1, Square s2, Square s3) {
-  return  (BetweenBB[s1][s2] | BetweenBB[s1][s3] | BetweenBB[s2][s3])
+  return  (between_bb(s1, s2) | between_bb(s1, s3) | between_bb(s2, s3))
         & (     SquareBB[s1] |      SquareBB[s2] |      SquareBB[s3]);
 }
 
 
+/// pext() gathers the bits of b selected by mask into the low bits of the
+/// result (BMI2 parallel bits extract). Used only if UsePext is set.
+
+#ifdef USE_CPUID
+
+FORCE_INLINE Bitboard pext(Bitboard b, Bitboard mask) {
+
+#  if defined(_MSC_VER)
+  return _pext_u64(b, mask);
+#  else
+  __asm__("pextq %2, %1, %0" : "=r" (b) : "r" (b), "rm" (mask));
+  return b;
+#  endif
+}
+
+#endif
+
+
 /// Functions for computing sliding attack bitboards. Function attacks_bb() takes
 /// a square and a bitboard of occupied squares as input, and returns a bitboard
 /// representing all squares attacked by Pt (bishop or rook) on the given square.
+/// The attacks table of a square is indexed either by a magic multiplication or,
+/// when the CPU has BMI2, directly by the pext of the relevant occupancy.
 template<PieceType Pt>
 FORCE_INLINE unsigned magic_index(Square s, Bitboard occ) {
 
@@ -241,6 +284,11 @@ FORCE_INLINE unsigned magic_index(Square s, Bitboard occ) {
   Bitboard* const Magics = Pt == ROOK ? RMagics : BMagics;
   unsigned* const Shifts = Pt == ROOK ? RShifts : BShifts;
 
+#ifdef USE_CPUID
+  if (UsePext)
+      return unsigned(pext(occ, Masks[s]));
+#endif
+
   if (Is64Bit)
       return unsigned(((occ & Masks[s]) * Magics[s]) >> Shifts[s]);
 
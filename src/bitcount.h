@@ -39,11 +39,45 @@ const BitCountType Full  = HasPopCnt ? CNT_HW_POPCNT : Is64Bit ? CNT_64 : CNT_32
 const BitCountType Max15 = HasPopCnt ? CNT_HW_POPCNT : Is64Bit ? CNT_64_MAX15 : CNT_32_MAX15;
 
 
+#ifdef USE_CPUID
+extern bool UsePopCnt; // Whether the CPU running us has the popcnt instruction
+#endif
+
 /// popcount() counts the number of nonzero bits in a bitboard
 template<BitCountType> inline int popcount(Bitboard);
 
+template<>
+inline int popcount<CNT_HW_POPCNT>(Bitboard b) {
+
+#if !defined(USE_POPCNT) && !defined(USE_CPUID)
+
+  assert(false);
+  return b != 0; // Avoid 'b not used' warning
+
+#elif defined(_MSC_VER) && defined(__INTEL_COMPILER)
+
+  return _mm_popcnt_u64(b);
+
+#elif defined(_MSC_VER)
+
+  return (int)__popcnt64(b);
+
+#else
+
+  __asm__("popcnt %1, %0" : "=r" (b) : "r" (b));
+  return b;
+
+#endif
+}
+
+/// With USE_CPUID the software popcounts of a 64-bit build switch to the
+/// popcnt instruction when the CPU has it.
 template<>
 inline int popcount<CNT_64>(Bitboard b) {
+#ifdef USE_CPUID
+  if (UsePopCnt)
+      return popcount<CNT_HW_POPCNT>(b);
+#endif
   b -=  (b >> 1) & 0x5555555555555555ULL;
   b  = ((b >> 2) & 0x3333333333333333ULL) + (b & 0x3333333333333333ULL);
   b  = ((b >> 4) + b) & 0x0F0F0F0F0F0F0F0FULL;
@@ -52,6 +86,10 @@ inline int popcount<CNT_64>(Bitboard b) {
 
 template<>
 inline int popcount<CNT_64_MAX15>(Bitboard b) {
+#ifdef USE_CPUID
+  if (UsePopCnt)
+      return popcount<CNT_HW_POPCNT>(b);
+#endif
   b -=  (b >> 1) & 0x5555555555555555ULL;
   b  = ((b >> 2) & 0x3333333333333333ULL) + (b & 0x3333333333333333ULL);
   return (b * 0x1111111111111111ULL) >> 60;
@@ -78,28 +116,4 @@ inline int popcount<CNT_32_MAX15>(Bitboard b) {
   return ((v + w) * 0x11111111) >> 28;
 }
 
-template<>
-inline int popcount<CNT_HW_POPCNT>(Bitboard b) {
-
-#ifndef USE_POPCNT
-
-  assert(false);
-  return b != 0; // Avoid 'b not used' warning
-
-#elif defined(_MSC_VER) && defined(__INTEL_COMPILER)
-
-  return _mm_popcnt_u64(b);
-
-#elif defined(_MSC_VER)
-
-  return (int)__popcnt64(b);
-
-#else
-
-  __asm__("popcnt %1, %0" : "=r" (b) : "r" (b));
-  return b;
-
-#endif
-}
-
 #endif // #ifndef BITCOUNT_H_INCLUDED
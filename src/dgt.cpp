@@ -29,8 +29,13 @@
 #include <algorithm>
 #include <unistd.h>
 #include <deque>
+#include <map>
 
 
+#include "dgt.h"
+#include "dgtgame.h"
+#include "dgtpgn.h"
+#include "dgttrace.h"
 #include "evaluate.h"
 #include "notation.h"
 #include "position.h"
@@ -47,22 +52,220 @@ using namespace std;
 
 namespace DGT
 {
+  EventQueue Events; // Global object
+
+  /// EventQueue::push() appends an event and wakes up the DGT loop
+
+  void
+  EventQueue::push (EventType type, int data)
+  {
+    mutex.lock ();
+    if (active)
+      {
+        Event e;
+        e.type = type;
+        e.data = data;
+        events.push_back (e);
+        sleepCondition.notify_one ();
+      }
+    mutex.unlock ();
+  }
+
+  /// EventQueue::pop() waits up to msec milliseconds for an event. Returns false
+  /// if the queue is still empty when the time is over.
+
+  bool
+  EventQueue::pop (Event& e, int msec)
+  {
+    mutex.lock ();
+    if (events.empty () && msec > 0)
+      sleepCondition.wait_for (mutex, msec);
+    bool found = !events.empty ();
+    if (found)
+      {
+        e = events.front ();
+        events.pop_front ();
+      }
+    mutex.unlock ();
+    return found;
+  }
+
+  void
+  EventQueue::set_active (bool b)
+  {
+    mutex.lock ();
+    active = b;
+    events.clear ();
+    mutex.unlock ();
+  }
+
+  const int TickInterval = 1000; // Clock and analysis display refresh period, in milliseconds
+  const int LongDisplayTime = 3000; // Time a computer move stays on the clock before the game result or the book moves, in milliseconds
+  const int BackgroundSlice = 10000; // Time a background search keeps the shared engine while other boards wait, in milliseconds
+  const int MinMoveTime = 500; // Shortest fixed time search left after waiting for the shared engine, in milliseconds
+  const int PredictTime = 200; // Search time of the player position to find the replies we ponder on, in milliseconds
+  const int PonderSlice = 2000; // Time spent pondering on a predicted reply before the next one, in milliseconds
+  const int AnalysisSlice = 3000; // Time spent on a position before the next one in background analysis, in milliseconds
+  const size_t MaxCachedAnalyses = 4096; // The analysis cache is emptied when it grows larger
+
+  SharedEngine Engine; // Global object
+  int Sessions = 1; // Number of boards played at once
+
+  /// SharedEngine::acquire() gives the engine to the session of queue q if it is
+  /// free or already owned by q, possibly changing the priority of the owner.
+  /// Otherwise the request is queued if wait is set, and false is returned.
+
+  bool
+  SharedEngine::acquire (EventQueue* q, SearchPriority p, bool wait)
+  {
+    mutex.lock ();
+    bool granted = (owner == NULL || owner == q);
+    if (granted)
+      {
+        if (owner != q)
+          grantTime = Time::now ();
+        owner = q;
+        ownerPriority = p;
+        preempting = false;
+        for (deque<Request>::iterator it = requests.begin (); it != requests.end (); ++it)
+          if (p == SEARCH_BACKGROUND && it->priority == SEARCH_MOVE)
+            {
+              preempt (); // The owner gave up its move search, a waiting one goes first
+              break;
+            }
+      }
+    else if (wait)
+      {
+        for (deque<Request>::iterator it = requests.begin (); it != requests.end (); ++it)
+          if (it->queue == q)
+            {
+              requests.erase (it);
+              break;
+            }
+        Request r;
+        r.queue = q;
+        r.priority = p;
+        requests.push_back (r);
+        if (p == SEARCH_MOVE && ownerPriority == SEARCH_BACKGROUND)
+          preempt ();
+      }
+    mutex.unlock ();
+    return granted;
+  }
+
+  /// SharedEngine::release() is called by the owner once its search is stopped,
+  /// and hands the engine to the next request, or by a waiting session to drop
+  /// its request
+
+  void
+  SharedEngine::release (EventQueue* q)
+  {
+    mutex.lock ();
+    if (owner != q)
+      {
+        for (deque<Request>::iterator it = requests.begin (); it != requests.end (); ++it)
+          if (it->queue == q)
+            {
+              requests.erase (it);
+              break;
+            }
+        mutex.unlock ();
+        return;
+      }
+
+    owner = NULL;
+    preempting = false;
+    if (!requests.empty ())
+      {
+        deque<Request>::iterator next = requests.begin ();
+        for (deque<Request>::iterator it = requests.begin (); it != requests.end (); ++it)
+          if (it->priority == SEARCH_MOVE)
+            {
+              next = it;
+              break;
+            }
+        owner = next->queue;
+        ownerPriority = next->priority;
+        grantTime = Time::now ();
+        requests.erase (next);
+        owner->push (ENGINE_GRANTED);
+      }
+    mutex.unlock ();
+  }
+
+  /// SharedEngine::contended() returns true if some session waits for the engine
+
+  bool
+  SharedEngine::contended ()
+  {
+    mutex.lock ();
+    bool waiting = !requests.empty ();
+    mutex.unlock ();
+    return waiting;
+  }
+
+  /// SharedEngine::new_search() is called by the owner before each search it
+  /// starts. The main line published by the search of another session is
+  /// cleared, so that it never shows up on this board.
+
+  int
+  SharedEngine::new_search (EventQueue* q)
+  {
+    mutex.lock ();
+    if (lastClient != q)
+      {
+        Search::PVInfo none;
+        memset (&none, 0, sizeof (none));
+        Search::LastPV.publish (none);
+        lastClient = q;
+      }
+    int id = ++searchId;
+    mutex.unlock ();
+    return id;
+  }
+
+  /// SharedEngine::search_finished() is called by the search when it is over
+
+  void
+  SharedEngine::search_finished ()
+  {
+    mutex.lock ();
+    if (owner)
+      owner->push (SEARCH_FINISHED);
+    mutex.unlock ();
+  }
+
+  /// SharedEngine::tick() preempts a background search that kept the engine for
+  /// a time slice while other sessions wait
+
+  void
+  SharedEngine::tick ()
+  {
+    mutex.lock ();
+    if (   owner
+        && ownerPriority == SEARCH_BACKGROUND
+        && !requests.empty ()
+        && Time::now () - grantTime >= BackgroundSlice)
+      preempt ();
+    mutex.unlock ();
+  }
+
+  void
+  SharedEngine::preempt ()
+  {
+    if (!preempting)
+      {
+        preempting = true;
+        owner->push (ENGINE_PREEMPTED);
+      }
+  }
+
   //Global declarations
-  Search::LimitsType limits, resetLimits;
-  Color computerPlays;
-  vector<Move> game;
-  
-  ofstream pgnFile;
-  int plyCount = 0;
-  bool rewritePGN = false;
-  bool boardReversed = false;
+  Search::LimitsType resetLimits;
+  Search::StateStackPtr NoSetupStates; // The game keeps the history of the searched positions
   const char* StartFEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"; // FEN string of the initial position, normal chess
   const char* bookPath = "/opt/picochess/books/";
-  bool setupPosition = false; // If a custom position is setup
-  bool customPosition = false;
-  deque<string> fenQueue;
   u_int MAX_FEN_QUEUE_SIZE = 3;
-  char* customStartFEN;
 
   //choose opening book
   int NUM_OPENING_BOOKS = 11;
@@ -85,59 +288,204 @@ namespace DGT
 
   BookMap bookMap (rawData, rawData + NUM_OPENING_BOOKS);
 
-  volatile enum PlayMode
+  enum PlayMode
   {
       // Kibitz mode is game mode + commentary
     GAME, ANALYSIS, BOOK, TRAINING, KIBITZ
-  } playMode;
+  };
 
-  volatile enum ClockMode
+  enum ClockMode
   {
     FIXEDTIME, INFINITE, TOURNAMENT, BLITZ, BLITZFISCHER, SPECIAL
-  } clockMode;
+  };
 
   enum ClockButton
   {
     OFF, BACK, DECREASE, HOME, INCREASE, SELECT
-  } clockButton;
+  };
 
   enum MainMenu
   {
     DEFAULT, POSITION_SETUP, LEVEL, OPENING_BOOK, TIME_CONTROL, ENGINE, SYSTEM, MAX_MAIN
-  } mainMenu;
+  };
 
   enum PositionMenu
   {
      SCAN_POSITION, WHITE_TO_MOVE, BLACK_TO_MOVE, REVERSE_ORIENTATION, MAX_POSITION
-  } positionMenu;
-
-  int levelNum;
-  int bookNum;
-  int timeControlNum = -1;
+  };
 
   enum EngineMenu
   {
     COMING_SOON_ENG, MAX_ENGINE
-  } engineMenu;
+  };
 
   enum SYSTEM
   {
     BENCHMARK, COMING_SOON, MAX_SYSTEM
-  } systemMenu;
+  };
 
   enum MenuOperation
   {
     INC, DEC, ENABLE
   };
 
-  int fixedTime, blitzTime, fischerInc, wTime, bTime;
-  bool computerMoveFENReached = false;
-  volatile bool refreshPosition = false;
-  volatile bool searching = false;
-  string ponderHitFEN = "";
+  // Board changes are coalesced: a board is handed to the engine only once it
+  // did not change for the settle window, so the transient boards seen while a
+  // piece is moved do not each stop and restart the search.
+  enum BoardState { BOARD_STABLE, PIECE_LIFTED, MOVE_IN_PROGRESS };
+
+  /// A Session plays the game of one board. The first board uses the global
+  /// event queue and latency trace, so that a single board behaves as before,
+  /// the others get their own. Each session runs on its own thread, where its
+  /// dgtnix board is the current one, and searches with the shared engine.
+
+  struct Session
+  {
+    Session (int n, const string& p);
+
+    void run ();
+
+    int number;
+    string port;
+    EventQueue ownEvents;
+    LatencyTrace ownLatency;
+    EventQueue* events;
+    LatencyTrace* trace;
+    void* dgtBoard;
+
+    Search::LimitsType limits;
+    Color computerPlays;
+    GameState game; // Moves played on the board, with their board signatures
+    PgnWriter* pgnWriter; // Writes the PGN file in the background
+    PolyglotBook book;
+    string bookFile;
+    bool ownBook;
+    int skillLevel;
+    int plyCount;
+    bool boardReversed;
+    bool setupPosition; // If a custom position is setup
+    bool customPosition;
+    deque<string> fenQueue;
+    char* customStartFEN;
+
+    volatile PlayMode playMode;
+    volatile ClockMode clockMode;
+    ClockButton clockButton;
+    MainMenu mainMenu;
+    PositionMenu positionMenu;
+    EngineMenu engineMenu;
+    enum SYSTEM systemMenu;
+    int levelNum;
+    int bookNum;
+    int timeControlNum;
+
+    int fixedTime, blitzTime, fischerInc, wTime, bTime;
+    int displayPhase; // Which analysis information is shown at the next clock tick
+    bool computerMoveFENReached;
+    volatile bool refreshPosition;
+    volatile bool searching;
+    bool pendingSearch; // The search is queued until the shared engine is granted
+    int searchId; // Identifier of the last search we started on the shared engine
+    Time::point searchStartTime;
+    Key ponderHitKey; // Board signature after the move we are pondering on
+    Key computerMoveKey; // Board signature we wait for after the computer move
+    Move pondering; // The move we are pondering on, valid when ponderHitKey is set
+    vector<Move> ponderMoves; // The replies we ponder on in turn, best predicted first
+    vector<Key> ponderKeys; // Board signatures after each of the ponderMoves
+    size_t ponderIndex; // The one of the ponderMoves we are pondering on
+    Time::point ponderSliceEnd; // When we ponder on the next of the ponderMoves
+    bool predicting; // The search running looks for the ponderMoves
+    int predictLines; // Number of replies the prediction search looks for
+    map<Key, Search::PVInfo> analysisCache; // Deepest analysis of the positions met, by position key
+    Key analysisKey; // Key of the position being analysed
+    size_t analysisIndex; // Position being analysed: the game one, or the one after ponderMoves[analysisIndex - 1]
+    Time::point analysisSliceEnd; // When we analyse the next position
+    int ponderTries, ponderHits;
+    Square speculativeFrom; // Square of the lifted piece whose moves are searched ahead
+    bool speculating; // The last search launched is a speculative one, its PV is not ours
+    BoardState boardState;
+    string stableBoard; // Last board handed to the engine, as a dgtnix board array
+
+    void addToFenQueue (string fen);
+    void resetClock ();
+    void writeLatencyLog (bool withReport);
+    char* getStartFEN ();
+    void stopSearch ();
+    void waitSearch ();
+    void releaseEngine ();
+    bool readPV (Search::PVInfo& pi);
+    bool analysisPV (Search::PVInfo& pi);
+    void cacheAnalysis ();
+    void startSearch (Position& pos);
+    void launchSearch (Position& pos);
+    void applyOptions ();
+    void think (Position& pos, const Search::LimitsType& searchLimits, const std::vector<Move>& searchMoves);
+    void startPonder (Position& pos, size_t idx);
+    void predictReplies (Position& pos, int lines);
+    void startAnalysisSlice (Position& pos, size_t idx);
+    void collectPredictions (Position& pos);
+    Move isPonderMove (Key boardKey);
+    void clearGame ();
+    void switchToAnalysisMode ();
+    void switchToTrainMode ();
+    void switchToGameMode ();
+    void stopThinking ();
+    void switchToKibitzMode ();
+    void switchToBookMode ();
+    void completeSetupPosition (string strippedFen);
+    void setOpeningBook (BookMap::iterator it, bool change);
+    void setTimeControl (int num, bool set);
+    void reverseBoard ();
+    void configure (string fen);
+    Move isPlayable (Key boardKey);
+    BoardState classifyBoard (const char* board, Key boardKey, Square& lifted);
+    void startSpeculativeSearch (Square from);
+    void printTimeOnClock (int wClockTime, int bClockTime, bool wDots = true, bool bDots = true);
+    void printEngineEvalOnClock (int priority = DGTNIX_DISPLAY_NORMAL);
+    void refreshAnalysisDisplay ();
+    void display_top_book_moves (const Position& pos, const int num);
+    string getPgn (Position& pos, Move move);
+    void operateBook (MenuOperation mo);
+    void operateTimeControl (MenuOperation mo);
+    void operateLevel (MenuOperation mo);
+    void operateMainMenu ();
+    void operatePositionMenu (MenuOperation mo, string fen);
+    void processClockButton (string fen, int button);
+  };
+
+  Session::Session (int n, const string& p) :
+    number (n), port (p),
+    events (n == 1 ? &Events : &ownEvents), trace (n == 1 ? &Latency : &ownLatency), dgtBoard (NULL),
+    computerPlays (BLACK), pgnWriter (NULL), bookFile (string (bookPath) + "varied.bin"), ownBook (true),
+    skillLevel (Options["Skill Level"]), plyCount (0), boardReversed (false), setupPosition (false),
+    customPosition (false), customStartFEN (NULL), playMode (GAME), clockMode (FIXEDTIME), clockButton (OFF),
+    mainMenu (DEFAULT), positionMenu (SCAN_POSITION), engineMenu (COMING_SOON_ENG), systemMenu (BENCHMARK),
+    levelNum (0), bookNum (0), timeControlNum (-1), fixedTime (5000), blitzTime (0), fischerInc (0),
+    wTime (0), bTime (0), displayPhase (0), computerMoveFENReached (false), refreshPosition (false),
+    searching (false), pendingSearch (false), searchId (0), searchStartTime (0), ponderHitKey (0),
+    computerMoveKey (0), pondering (MOVE_NONE), ponderIndex (0), ponderSliceEnd (0), predicting (false),
+    predictLines (1), analysisKey (0), analysisIndex (0), analysisSliceEnd (0), ponderTries (0), ponderHits (0), speculativeFrom (SQ_NONE), speculating (false),
+    boardState (BOARD_STABLE), stableBoard (64, ' ') {}
+
+  extern "C" {
+    // Called on the dgtnix driver thread for every message received from the
+    // board, whose session is the user data of the dgtnix board
+    static void onDgtnixEvent (int event, int data)
+    {
+      Session* session = static_cast<Session*> (dgtnixGetUserData ());
+      if (event == DGTNIX_EVENT_BOARD)
+        {
+          session->trace->board_changed ();
+          session->events->push (BOARD_CHANGED);
+        }
+      else if (event == DGTNIX_EVENT_BUTTON) session->events->push (BUTTON_PRESSED, data);
+      else if (event == DGTNIX_EVENT_DISPLAYED) session->trace->displayed (data);
+      else if (event == DGTNIX_EVENT_CLOSED) session->events->push (BOARD_CLOSED);
+    }
+  }
 
   void
-  addToFenQueue (string fen)
+  Session::addToFenQueue (string fen)
   {
     fenQueue.push_back (fen);
     if (fenQueue.size () > MAX_FEN_QUEUE_SIZE)
@@ -147,7 +495,7 @@ namespace DGT
   }
 
   void
-  resetClock ()
+  Session::resetClock ()
   {
     limits = resetLimits;
     if (clockMode == BLITZ)
@@ -168,10 +516,24 @@ namespace DGT
         limits.infinite = true;
       }
   }
-  void printTimeOnClock (int wClockTime, int bClockTime, bool wDots, bool bDots);
+  /// Write the latencies of the moves traced since the last call to the latency
+  /// log, if enabled, followed by the histograms when a game ends
+
+  void
+  Session::writeLatencyLog (bool withReport)
+  {
+    string lines = trace->take_log ();
+    if (!Options["DGT Latency Log"] || (lines.empty () && !withReport))
+      return;
+
+    Log log (Options["DGT Latency Log Filename"]);
+    log << lines;
+    if (withReport)
+      log << trace->report () << endl;
+  }
 
   char*
-  getStartFEN ()
+  Session::getStartFEN ()
   {
     char * fen;
 
@@ -189,6 +551,279 @@ namespace DGT
 
   }
 
+  /// Stop the search if it is ours, or cancel our request for the shared engine.
+  /// A running search is stopped only by its owner, and only the owner waits for
+  /// it, the search of another board does not use our game states.
+
+  void
+  Session::stopSearch ()
+  {
+    predicting = false;
+    if (Engine.owns (events))
+      UCI::loop ("stop");
+    else if (pendingSearch)
+      {
+        Engine.release (events);
+        pendingSearch = false;
+        searching = false; //the search never started
+      }
+  }
+
+  void
+  Session::waitSearch ()
+  {
+    if (Engine.owns (events))
+      Threads.wait_for_think_finished ();
+  }
+
+  /// Stop our search and hand the shared engine to the next board waiting for it
+
+  void
+  Session::releaseEngine ()
+  {
+    stopSearch ();
+    waitSearch ();
+    Engine.release (events);
+    pendingSearch = false;
+  }
+
+  /// Read the main line of the search, provided it is our search
+
+  bool
+  Session::readPV (Search::PVInfo& pi)
+  {
+    return    Engine.owns (events)
+           && Engine.search_id () == searchId
+           && Search::LastPV.read (pi)
+           && Engine.search_id () == searchId;
+  }
+
+  /// Read the analysis of the game position: the running search, or the deepest
+  /// one found in the background analysis cache
+
+  bool
+  Session::analysisPV (Search::PVInfo& pi)
+  {
+    bool live = analysisIndex == 0 && readPV (pi) && pi.pvLength;
+    map<Key, Search::PVInfo>::const_iterator it = analysisCache.find (game.position ().key ());
+    if (it != analysisCache.end () && (!live || it->second.depth > pi.depth))
+      {
+        pi = it->second;
+        return true;
+      }
+    return live;
+  }
+
+  /// Keep the main line of the background analysis running, unless a deeper one
+  /// of the same position is already known
+
+  void
+  Session::cacheAnalysis ()
+  {
+    Search::PVInfo pi;
+    if (!int(Options["DGT Background Analysis"]) || predicting || !readPV (pi) || !pi.pvLength)
+      return;
+    if (analysisCache.size () >= MaxCachedAnalyses && !analysisCache.count (analysisKey))
+      analysisCache.clear ();
+    map<Key, Search::PVInfo>::iterator it = analysisCache.find (analysisKey);
+    if (it == analysisCache.end () || pi.depth >= it->second.depth)
+      analysisCache[analysisKey] = pi;
+  }
+
+  /// The UCI options of the search are shared by all the boards, so each board
+  /// sets its own values before it starts a search
+
+  void
+  Session::applyOptions ()
+  {
+    stringstream level;
+    level << skillLevel;
+    Options["Skill Level"] = level.str ();
+    Options["Book File"] = bookFile;
+    Options["OwnBook"] = string (ownBook ? "true" : "false");
+    if (int(Options["DGT Ponder Candidates"]) > 1 || int(Options["DGT Background Analysis"]))
+      {
+        stringstream lines;
+        lines << (predicting ? predictLines : 1);
+        Options["MultiPV"] = lines.str ();
+      }
+  }
+
+  void
+  Session::think (Position& pos, const Search::LimitsType& searchLimits, const vector<Move>& searchMoves)
+  {
+    applyOptions ();
+    searchId = Engine.new_search (events);
+    Threads.start_thinking (pos, searchLimits, searchMoves, NoSetupStates);
+  }
+
+  /// Search the computer move, as soon as the shared engine is ours. The time
+  /// spent waiting for the engine counts against the time of the computer.
+
+  void
+  Session::startSearch (Position& pos)
+  {
+    searching = true;
+    if (Engine.acquire (events, clockMode == INFINITE ? SEARCH_BACKGROUND : SEARCH_MOVE))
+      launchSearch (pos);
+    else
+      {
+        cout << "board " << number << " waits for the engine" << endl;
+        pendingSearch = true;
+      }
+  }
+
+  void
+  Session::launchSearch (Position& pos)
+  {
+    stopSearch ();
+    //set time limits
+    if (clockMode == BLITZ || clockMode == BLITZFISCHER)
+      {
+        limits.time[WHITE] = max (wTime, 0);
+        limits.time[BLACK] = max (bTime, 0);
+        limits.inc[WHITE] = limits.inc[BLACK] = fischerInc;
+      }
+    limits.ponder = false;
+    ponderHitKey = 0;
+    Search::LimitsType searchLimits = limits;
+    if (pendingSearch)
+      {
+        int waited = int(Time::now () - searchStartTime);
+        if (limits.movetime)
+          searchLimits.movetime = max (limits.movetime - waited, MinMoveTime);
+        if (limits.time[computerPlays])
+          searchLimits.time[computerPlays] = max (limits.time[computerPlays] - waited, 0);
+        pendingSearch = false;
+      }
+    cout << "board " << number << " searching" << endl;
+    speculating = false;
+    analysisIndex = 0;
+    if (clockMode == INFINITE && int(Options["DGT Background Analysis"]))
+      {
+        //show at once what the background analysis knows of the position
+        if (analysisCache.count (pos.key ()))
+          {
+            cout << "cached analysis depth " << analysisCache[pos.key ()].depth << endl;
+            printEngineEvalOnClock (DGTNIX_DISPLAY_INFO);
+          }
+        ponderMoves.clear ();
+        ponderKeys.clear ();
+        startAnalysisSlice (pos, 0);
+      }
+    else
+      think (pos, searchLimits, vector<Move > ());
+    trace->stamp (LAT_SEARCH_START);
+  }
+
+  /// Ponder on the predicted reply idx, with its own root state so that a
+  /// ponder hit continues the search whatever the reply we pondered on before.
+  /// Nothing is done if another board owns the engine.
+
+  void
+  Session::startPonder (Position& pos, size_t idx)
+  {
+    if (!Engine.acquire (events, SEARCH_BACKGROUND, false))
+      {
+        ponderHitKey = 0;
+        return;
+      }
+    predicting = false;
+    analysisIndex = 0;
+    ponderIndex = idx;
+    pondering = ponderMoves[idx];
+    game.do_ponder_move (pondering, int(idx));
+    ponderHitKey = ponderKeys[idx];
+    //Launch ponder search
+    if (clockMode == BLITZ || clockMode == BLITZFISCHER)
+      {
+        limits.time[WHITE] = max (wTime, 0);
+        limits.time[BLACK] = max (bTime, 0);
+        limits.inc[WHITE] = limits.inc[BLACK] = fischerInc;
+      }
+    limits.ponder = true;
+    speculating = false;
+    think (pos, limits, vector<Move > ());
+    game.undo_ponder_move (pondering);
+    ponderSliceEnd = Time::now () + PonderSlice;
+  }
+
+  /// With several ponder candidates, a short MultiPV search of the player
+  /// position finds the replies we ponder on. They are read back by
+  /// collectPredictions() once the search is over, then pondered on in turn
+  /// for a slice each. A ponder hit on the reply being searched continues the
+  /// search, a hit on another one starts a search on a warm hash table.
+
+  void
+  Session::predictReplies (Position& pos, int lines)
+  {
+    if (!Engine.acquire (events, SEARCH_BACKGROUND, false))
+      return;
+    Search::LimitsType predictLimits;
+    predictLimits.movetime = PredictTime;
+    predictLines = lines;
+    analysisIndex = 0;
+    predicting = true; //MultiPV is set by think()
+    speculating = true; //the main line is the player's
+    think (pos, predictLimits, vector<Move > ());
+  }
+
+  void
+  Session::collectPredictions (Position& pos)
+  {
+    ponderMoves.clear ();
+    ponderKeys.clear ();
+    size_t n = min (Search::RootMoves.size (), size_t(predictLines));
+    for (size_t i = 0; i < n; ++i)
+      {
+        Move m = Search::RootMoves[i].pv[0];
+        game.do_ponder_move (m, int(i));
+        ponderMoves.push_back (m);
+        ponderKeys.push_back (board_key (pos));
+        game.undo_ponder_move (m);
+      }
+    if (ponderMoves.empty ())
+      return;
+    if (clockMode == INFINITE)
+      startAnalysisSlice (pos, 1);
+    else
+      startPonder (pos, 0);
+  }
+
+  /// In ANALYSIS and TRAINING modes, while the player thinks, the game position
+  /// and the positions after the likely replies are analysed in turn for a slice
+  /// each. The deepest line found for each of them is kept by cacheAnalysis(),
+  /// so that the clock shows a deep eval as soon as a predicted move is played.
+
+  void
+  Session::startAnalysisSlice (Position& pos, size_t idx)
+  {
+    if (!Engine.owns (events)) //the callers own the engine, never search on the one of another board
+      return;
+    predicting = false;
+    speculating = false;
+    analysisIndex = idx;
+    if (idx)
+      game.do_ponder_move (ponderMoves[idx - 1], int(idx - 1));
+    analysisKey = pos.key ();
+    think (pos, limits, vector<Move > ());
+    if (idx)
+      game.undo_ponder_move (ponderMoves[idx - 1]);
+    analysisSliceEnd = Time::now () + AnalysisSlice;
+  }
+
+  /// Return the predicted reply leading to the given board, if any
+
+  Move
+  Session::isPonderMove (Key boardKey)
+  {
+    if (ponderHitKey)
+      for (size_t i = 0; i < ponderKeys.size (); ++i)
+        if (ponderKeys[i] == boardKey)
+          return ponderMoves[i];
+    return MOVE_NONE;
+  }
+
   /// Give the current board setup as FEN string
   /// char  :  tomove = 'w' or 'b' : the side to move (white is default)
 
@@ -263,21 +898,24 @@ namespace DGT
   }
 
   void
-  clearGame ()
+  Session::clearGame ()
   {
-    UCI::loop ("stop"); //stop the current search
-    ponderHitFEN == "";
+    releaseEngine (); //the search may still use the game states
+    ponderHitKey = 0;
     computerMoveFENReached = false;
     searching = false;
-    game.clear (); //reset the game
-    TT.clear ();
+    analysisCache.clear ();
+    game.reset (getStartFEN ()); //reset the game
+    if (Sessions == 1) //the other boards share the table
+      TT.clear ();
     resetClock ();
     if (clockMode == BLITZ || clockMode == BLITZFISCHER)
       printTimeOnClock (wTime, bTime, true, true);
     else
       dgtnixPrintMessageOnClock ("newgam", false, false);
     plyCount = 0;
-    pgnFile << "\n";
+    pgnWriter->new_game ();
+    writeLatencyLog (true);
   }
 
   string
@@ -319,7 +957,7 @@ namespace DGT
 
   /// Change UCI parameters with special positions on the board
 
-  void switchToAnalysisMode()
+  void Session::switchToAnalysisMode()
   {
     dgtnixPrintMessageOnClock ("analyz", true, false);
     playMode = ANALYSIS;
@@ -327,7 +965,7 @@ namespace DGT
     resetClock();
   }
 
-  void switchToTrainMode()
+  void Session::switchToTrainMode()
   {
     dgtnixPrintMessageOnClock (" train", true, false);
     playMode = TRAINING;
@@ -335,7 +973,7 @@ namespace DGT
     resetClock();
   }
 
-  void switchToGameMode()
+  void Session::switchToGameMode()
   {
     dgtnixPrintMessageOnClock ("  game", true, false);
     playMode = GAME;
@@ -347,18 +985,18 @@ namespace DGT
     resetClock();
   }
 
-  void stopThinking()
+  void Session::stopThinking()
   {
       // Get out of infinite analysis and stop thinking
       if (clockMode == INFINITE)
       {
           clockMode = FIXEDTIME;
       }
-      UCI::loop ("stop"); //stop the current search
+      releaseEngine (); //stop the current search
       searching = false;
   }
 
-  void switchToKibitzMode()
+  void Session::switchToKibitzMode()
   {
     dgtnixPrintMessageOnClock ("chatty", true, false);
     playMode = KIBITZ;
@@ -370,7 +1008,7 @@ namespace DGT
     resetClock();
   }
 
-  void switchToBookMode()
+  void Session::switchToBookMode()
   {
     dgtnixPrintMessageOnClock ("  book", true, false);
     playMode = BOOK;
@@ -382,7 +1020,7 @@ namespace DGT
     resetClock();
   }
 
-  void completeSetupPosition(string strippedFen)
+  void Session::completeSetupPosition(string strippedFen)
   {
       setupPosition = false;
       customPosition = true;
@@ -399,350 +1037,182 @@ namespace DGT
       clearGame ();
   }
 
-  void setOpeningBook(BookMap::iterator it, bool change)
+  void Session::setOpeningBook(BookMap::iterator it, bool change)
   {
     if (it != bookMap.end ())
       {
         string s = it->second;
         if (change) {
-          UCI::loop (string ("setoption name Book File value ") + bookPath + s + ".bin");
-          UCI::loop (string ("setoption name OwnBook value ")+(s.compare ("nobook") ? "true" : "false"));
+          bookFile = string (bookPath) + s + ".bin";
+          ownBook = s.compare ("nobook");
           }
         if (s.size () < 6) s.insert (s.begin (), 6 - s.size (), ' ');
         dgtnixPrintMessageOnClock (s.c_str (), true, false);
       }
   }
 
-  void setTimeControl(string fen, bool set, bool clockMenu)
-  {
-    if (!clockMenu) {
-        timeControlNum = -1;
-      }
+  // Time controls, in menu order. They are also set by putting a white queen on
+  // ranks 3 to 6 of the start position:
+  // fixed time per move: 1, 3, 5, 10, 15, 30, 60, 120 seconds
+  // blitz: 1, 3, 5, 10, 15, 30, 60, 90 minutes
+  // blitz fischer: 3+2, 4+2, 5+3, 5+5, 15+5, 25+10, 90+30
+  struct TimeControl {
+    const char* fen;
+    const char* message;
+    unsigned char dots;
+    ClockMode mode;
+    int time; // Time per move in FIXEDTIME mode, time per game otherwise, in milliseconds
+    int inc;  // Fischer increment in BLITZFISCHER mode
+  };
 
-    if (fen == "rnbqkbnr/pppppppp/Q7/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1" || timeControlNum == 0)
-      {
-        dgtnixPrintMessageOnClock ("mov001", true, DGTNIX_RIGHT_DOT);
-        if (set) {
-            fixedTime = 1000;
-            clockMode = FIXEDTIME;
-            resetClock ();
-          }
-      }
-    if (fen == "rnbqkbnr/pppppppp/1Q6/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1" || timeControlNum == 1)
-      {
-        dgtnixPrintMessageOnClock ("mov003", true, DGTNIX_RIGHT_DOT);
-        if (set) {
-            fixedTime = 3000;
-            clockMode = FIXEDTIME;
-            resetClock ();
-          }
-      }
-    if (fen == "rnbqkbnr/pppppppp/2Q5/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1" || timeControlNum == 2)
-      {
-        dgtnixPrintMessageOnClock ("mov005", true, DGTNIX_RIGHT_DOT);
-        if (set) {
-            fixedTime = 5000;
-            clockMode = FIXEDTIME;
-            resetClock ();
-          }
-      }
-    if (fen == "rnbqkbnr/pppppppp/3Q4/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1" || timeControlNum == 3)
-      {
-        dgtnixPrintMessageOnClock ("mov010", true, DGTNIX_RIGHT_DOT);
-        if (set) {
-            fixedTime = 10000;
-            clockMode = FIXEDTIME;
-            resetClock ();
-          }
-      }
-    if (fen == "rnbqkbnr/pppppppp/4Q3/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1" || timeControlNum == 4)
-      {
-        dgtnixPrintMessageOnClock ("mov015", true, DGTNIX_RIGHT_DOT);
-        if (set) {
-            fixedTime = 15000;
-            clockMode = FIXEDTIME;
-            resetClock ();
-          }
-      }
-    if (fen == "rnbqkbnr/pppppppp/5Q2/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1" || timeControlNum == 5)
-      {
-        dgtnixPrintMessageOnClock ("mov030", true, DGTNIX_RIGHT_DOT);
-        if (set) {
-            fixedTime = 30000;
-            clockMode = FIXEDTIME;
-            resetClock ();
-          }
-      }
-    if (fen == "rnbqkbnr/pppppppp/6Q1/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1" || timeControlNum == 6)
-      {
-        dgtnixPrintMessageOnClock ("mov100", true, DGTNIX_RIGHT_DOT);
-        if (set) {
-            fixedTime = 60000;
-            clockMode = FIXEDTIME;
-            resetClock ();
-          }
-      }
-    if (fen == "rnbqkbnr/pppppppp/7Q/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1" || timeControlNum == 7)
-      {
-        dgtnixPrintMessageOnClock ("mov200", true, DGTNIX_RIGHT_DOT);
-        if (set) {
-            fixedTime = 120000;
-            clockMode = FIXEDTIME;
-            resetClock ();
-        }
-      }
-    //blitz modes : 1, 3, 5, 10, 15, 30, 60, 90  minutes
-    if (fen == "rnbqkbnr/pppppppp/8/8/Q7/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1" || timeControlNum == 8)
-      {
-        dgtnixPrintMessageOnClock ("bli100", true, DGTNIX_RIGHT_DOT);
-        if (set) {
-            blitzTime = 60000;
-            clockMode = BLITZ;
-            resetClock ();
-          }
-      }
-    if (fen == "rnbqkbnr/pppppppp/8/8/1Q6/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1" || timeControlNum == 9)
-      {
-        dgtnixPrintMessageOnClock ("bli300", true, DGTNIX_RIGHT_DOT);
-        if (set) {
-            blitzTime = 180000;
-            clockMode = BLITZ;
-            resetClock ();
-          }
-      }
-    if (fen == "rnbqkbnr/pppppppp/8/8/2Q5/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1" || timeControlNum == 10)
-      {
-        dgtnixPrintMessageOnClock ("bli500", true, DGTNIX_RIGHT_DOT);
-        if (set) {
-            blitzTime = 300000;
-            clockMode = BLITZ;
-            resetClock ();
-          }
-      }
-    if (fen == "rnbqkbnr/pppppppp/8/8/3Q4/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1" || timeControlNum == 11)
-      {
-        dgtnixPrintMessageOnClock ("bli000", true, DGTNIX_RIGHT_DOT | DGTNIX_RIGHT_1);
-        if (set) {
-            blitzTime = 600000;
-            clockMode = BLITZ;
-            resetClock ();
-          }
-      }
-    if (fen == "rnbqkbnr/pppppppp/8/8/4Q3/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1" || timeControlNum == 12)
-      {
-        dgtnixPrintMessageOnClock ("bli500", true, DGTNIX_RIGHT_DOT | DGTNIX_RIGHT_1);
-        if (set) {
-            blitzTime = 900000;
-            clockMode = BLITZ;
-            resetClock ();
-          }
-      }
-    if (fen == "rnbqkbnr/pppppppp/8/8/5Q2/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1" || timeControlNum == 13)
-      {
-        dgtnixPrintMessageOnClock ("bli030", true, DGTNIX_RIGHT_SEMICOLON);
-        if (set) {
-            blitzTime = 1800000;
-            clockMode = BLITZ;
-            resetClock ();
-          }
-      }
-    if (fen == "rnbqkbnr/pppppppp/8/8/6Q1/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1" || timeControlNum == 14)
-      {
-        dgtnixPrintMessageOnClock ("bli100", true, DGTNIX_RIGHT_SEMICOLON);
-        if (set) {
-            blitzTime = 3600000;
-            clockMode = BLITZ;
-            resetClock ();
-          }
-      }
-    if (fen == "rnbqkbnr/pppppppp/8/8/7Q/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1" || timeControlNum == 15)
-      {
-        dgtnixPrintMessageOnClock ("bli130", true, DGTNIX_RIGHT_SEMICOLON);
-        if (set) {
-            blitzTime = 5400000;
-            clockMode = BLITZ;
-            resetClock ();
-          }
-      }
-    //'Blitz Fischer' + 'Special Lvl' 3+2, 3+5, 4+5, 5+1, 15+5, 20+10, opponents average, 1/2 opponents average
-    if (fen == "rnbqkbnr/pppppppp/8/8/8/Q7/PPPPPPPP/RNBQKBNR w KQkq - 0 1" || timeControlNum == 16)
-      {
-        dgtnixPrintMessageOnClock ("f 32  ", true, false);
-        if (set) {
-            // The stockfish controls are all in milliseconds
-            // 3 minutes => 3 * 60 * 1000 to convert milliseconds to seconds
-            blitzTime = 3 * 60 * 1000;
-            fischerInc = 2 * 1000;
-            clockMode = BLITZFISCHER;
-            resetClock ();
-          }
-      }
-    if (fen == "rnbqkbnr/pppppppp/8/8/8/1Q6/PPPPPPPP/RNBQKBNR w KQkq - 0 1" || timeControlNum == 17)
-      {
-        dgtnixPrintMessageOnClock ("f 42  ", true, false);
-        if (set) {
-            blitzTime = 4 * 60 * 1000;
-            fischerInc = 2 * 1000;
-            clockMode = BLITZFISCHER;
-            resetClock ();
-          }
-      }
-    if (fen == "rnbqkbnr/pppppppp/8/8/8/2Q5/PPPPPPPP/RNBQKBNR w KQkq - 0 1" || timeControlNum == 18)
-      {
-        dgtnixPrintMessageOnClock ("f 53  ", true, false);
-        if (set) {
-            blitzTime = 5 * 60 * 1000;
-            fischerInc = 3 * 1000;
-            clockMode = BLITZFISCHER;
-            resetClock ();
-          }
-      }
-    if (fen == "rnbqkbnr/pppppppp/8/8/8/3Q4/PPPPPPPP/RNBQKBNR w KQkq - 0 1" || timeControlNum == 19)
-      {
-        dgtnixPrintMessageOnClock ("f 55  ", true, false);
-        if (set) {
-            blitzTime = 5 * 60 * 1000;
-            fischerInc = 5 * 1000;
-            clockMode = BLITZFISCHER;
-            resetClock ();
-          }
-      }
-    if (fen == "rnbqkbnr/pppppppp/8/8/8/4Q3/PPPPPPPP/RNBQKBNR w KQkq - 0 1" || timeControlNum == 20)
-      {
-        dgtnixPrintMessageOnClock ("f155  ", true, false);
-        if (set) {
-            blitzTime = 15 * 60 * 1000;
-            fischerInc = 5 * 1000;
-            clockMode = BLITZFISCHER;
-            resetClock ();
-          }
-      }
-    if (fen == "rnbqkbnr/pppppppp/8/8/8/5Q2/PPPPPPPP/RNBQKBNR w KQkq - 0 1" || timeControlNum == 21)
-      {
-        dgtnixPrintMessageOnClock ("f2510 ", true, false);
-        if (set) {
-            blitzTime = 25 * 60 * 1000;
-            fischerInc = 10 * 1000;
-            clockMode = BLITZFISCHER;
-            resetClock ();
-          }
-      }
+  const TimeControl TimeControls[] = {
+    { "rnbqkbnr/pppppppp/Q7/8/8/8/PPPPPPPP/RNBQKBNR",  "mov001", DGTNIX_RIGHT_DOT,                  FIXEDTIME,    1000,           0 },
+    { "rnbqkbnr/pppppppp/1Q6/8/8/8/PPPPPPPP/RNBQKBNR", "mov003", DGTNIX_RIGHT_DOT,                  FIXEDTIME,    3000,           0 },
+    { "rnbqkbnr/pppppppp/2Q5/8/8/8/PPPPPPPP/RNBQKBNR", "mov005", DGTNIX_RIGHT_DOT,                  FIXEDTIME,    5000,           0 },
+    { "rnbqkbnr/pppppppp/3Q4/8/8/8/PPPPPPPP/RNBQKBNR", "mov010", DGTNIX_RIGHT_DOT,                  FIXEDTIME,    10000,          0 },
+    { "rnbqkbnr/pppppppp/4Q3/8/8/8/PPPPPPPP/RNBQKBNR", "mov015", DGTNIX_RIGHT_DOT,                  FIXEDTIME,    15000,          0 },
+    { "rnbqkbnr/pppppppp/5Q2/8/8/8/PPPPPPPP/RNBQKBNR", "mov030", DGTNIX_RIGHT_DOT,                  FIXEDTIME,    30000,          0 },
+    { "rnbqkbnr/pppppppp/6Q1/8/8/8/PPPPPPPP/RNBQKBNR", "mov100", DGTNIX_RIGHT_DOT,                  FIXEDTIME,    60000,          0 },
+    { "rnbqkbnr/pppppppp/7Q/8/8/8/PPPPPPPP/RNBQKBNR",  "mov200", DGTNIX_RIGHT_DOT,                  FIXEDTIME,    120000,         0 },
+    { "rnbqkbnr/pppppppp/8/8/Q7/8/PPPPPPPP/RNBQKBNR",  "bli100", DGTNIX_RIGHT_DOT,                  BLITZ,        60000,          0 },
+    { "rnbqkbnr/pppppppp/8/8/1Q6/8/PPPPPPPP/RNBQKBNR", "bli300", DGTNIX_RIGHT_DOT,                  BLITZ,        180000,         0 },
+    { "rnbqkbnr/pppppppp/8/8/2Q5/8/PPPPPPPP/RNBQKBNR", "bli500", DGTNIX_RIGHT_DOT,                  BLITZ,        300000,         0 },
+    { "rnbqkbnr/pppppppp/8/8/3Q4/8/PPPPPPPP/RNBQKBNR", "bli000", DGTNIX_RIGHT_DOT | DGTNIX_RIGHT_1, BLITZ,        600000,         0 },
+    { "rnbqkbnr/pppppppp/8/8/4Q3/8/PPPPPPPP/RNBQKBNR", "bli500", DGTNIX_RIGHT_DOT | DGTNIX_RIGHT_1, BLITZ,        900000,         0 },
+    { "rnbqkbnr/pppppppp/8/8/5Q2/8/PPPPPPPP/RNBQKBNR", "bli030", DGTNIX_RIGHT_SEMICOLON,            BLITZ,        1800000,        0 },
+    { "rnbqkbnr/pppppppp/8/8/6Q1/8/PPPPPPPP/RNBQKBNR", "bli100", DGTNIX_RIGHT_SEMICOLON,            BLITZ,        3600000,        0 },
+    { "rnbqkbnr/pppppppp/8/8/7Q/8/PPPPPPPP/RNBQKBNR",  "bli130", DGTNIX_RIGHT_SEMICOLON,            BLITZ,        5400000,        0 },
+    { "rnbqkbnr/pppppppp/8/8/8/Q7/PPPPPPPP/RNBQKBNR",  "f 32  ", 0,                                 BLITZFISCHER, 3 * 60 * 1000,  2 * 1000 },
+    { "rnbqkbnr/pppppppp/8/8/8/1Q6/PPPPPPPP/RNBQKBNR", "f 42  ", 0,                                 BLITZFISCHER, 4 * 60 * 1000,  2 * 1000 },
+    { "rnbqkbnr/pppppppp/8/8/8/2Q5/PPPPPPPP/RNBQKBNR", "f 53  ", 0,                                 BLITZFISCHER, 5 * 60 * 1000,  3 * 1000 },
+    { "rnbqkbnr/pppppppp/8/8/8/3Q4/PPPPPPPP/RNBQKBNR", "f 55  ", 0,                                 BLITZFISCHER, 5 * 60 * 1000,  5 * 1000 },
+    { "rnbqkbnr/pppppppp/8/8/8/4Q3/PPPPPPPP/RNBQKBNR", "f155  ", 0,                                 BLITZFISCHER, 15 * 60 * 1000, 5 * 1000 },
+    { "rnbqkbnr/pppppppp/8/8/8/5Q2/PPPPPPPP/RNBQKBNR", "f2510 ", 0,                                 BLITZFISCHER, 25 * 60 * 1000, 10 * 1000 },
+    { "rnbqkbnr/pppppppp/8/8/8/6Q1/PPPPPPPP/RNBQKBNR", "f9030 ", 0,                                 BLITZFISCHER, 90 * 60 * 1000, 30 * 1000 }
+  };
 
-    if (fen == "rnbqkbnr/pppppppp/8/8/8/6Q1/PPPPPPPP/RNBQKBNR w KQkq - 0 1" || timeControlNum == MAX_TIME_CONTROL_NUM)
-      {
-        dgtnixPrintMessageOnClock ("f9030 ", true, false);
-        if (set) {
-            blitzTime = 90 * 60 * 1000;
-            fischerInc = 30 * 1000;
-            clockMode = BLITZFISCHER;
-            resetClock ();
-          }
+  void Session::setTimeControl(int num, bool set)
+  {
+    const TimeControl& tc = TimeControls[num];
+    dgtnixPrintMessageOnClock (tc.message, true, tc.dots);
+    if (set) {
+        if (tc.mode == FIXEDTIME)
+          fixedTime = tc.time;
+        else
+          blitzTime = tc.time;
+        if (tc.mode == BLITZFISCHER)
+          fischerInc = tc.inc;
+        clockMode = tc.mode;
+        resetClock ();
       }
   }
 
-  void reverseBoard()
+  void Session::reverseBoard()
   {
     dgtnixSetOption (DGTNIX_BOARD_ORIENTATION, boardReversed ? DGTNIX_BOARD_ORIENTATION_CLOCKLEFT : DGTNIX_BOARD_ORIENTATION_CLOCKRIGHT);
     boardReversed = !boardReversed;
-    sem_post (&dgtnixEventSemaphore);
+    events->push (BOARD_CHANGED);
+  }
+
+  /// Command positions are special positions on the board, mostly the start
+  /// position with an extra queen, used to change the settings. They are
+  /// recognized by their board signature, so a board is matched against all the
+  /// commands with a single lookup whatever their number.
+
+  enum CommandType
+  {
+    SET_SKILL, SET_TIME_CONTROL, SET_BOOK, SET_PLAY_MODE, REVERSE_BOARD,
+    SETUP_POSITION, CHOOSE_SIDE, NEW_GAME, SHUTDOWN
+  };
+
+  struct Command
+  {
+    CommandType type;
+    int arg; // Skill level, time control, book or play mode number, or color
+  };
+
+  typedef map<Key, Command> CommandMap;
+  CommandMap commands;
+
+  void
+  addCommand (const string& fen, CommandType type, int arg = 0)
+  {
+    Command c;
+    c.type = type;
+    c.arg = arg;
+    commands[fen_board_key (fen)] = c;
   }
 
   void
-  configure (string fen)
+  init_commands ()
   {
-//        cout << "Fen received: "<< fen;
-    //set skill level
-    static string skillFENs[] = {
-      "rnbqkbnr/pppppppp/q7/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
-      "rnbqkbnr/pppppppp/1q6/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
-      "rnbqkbnr/pppppppp/2q5/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
-      "rnbqkbnr/pppppppp/3q4/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
-      "rnbqkbnr/pppppppp/4q3/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
-      "rnbqkbnr/pppppppp/5q2/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
-      "rnbqkbnr/pppppppp/6q1/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
-      "rnbqkbnr/pppppppp/7q/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
-      "rnbqkbnr/pppppppp/8/q7/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
-      "rnbqkbnr/pppppppp/8/1q6/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
-      "rnbqkbnr/pppppppp/8/2q5/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
-      "rnbqkbnr/pppppppp/8/3q4/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
-      "rnbqkbnr/pppppppp/8/4q3/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
-      "rnbqkbnr/pppppppp/8/5q2/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
-      "rnbqkbnr/pppppppp/8/6q1/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
-      "rnbqkbnr/pppppppp/8/7q/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
-      "rnbqkbnr/pppppppp/8/8/q7/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
-      "rnbqkbnr/pppppppp/8/8/1q6/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
-      "rnbqkbnr/pppppppp/8/8/2q5/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
-      "rnbqkbnr/pppppppp/8/8/3q4/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
-      "rnbqkbnr/pppppppp/8/8/4q3/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"
+    //set skill level : black queen on ranks 6 to 4 of the start position
+    static const char* SkillFENs[] = {
+      "rnbqkbnr/pppppppp/q7/8/8/8/PPPPPPPP/RNBQKBNR",
+      "rnbqkbnr/pppppppp/1q6/8/8/8/PPPPPPPP/RNBQKBNR",
+      "rnbqkbnr/pppppppp/2q5/8/8/8/PPPPPPPP/RNBQKBNR",
+      "rnbqkbnr/pppppppp/3q4/8/8/8/PPPPPPPP/RNBQKBNR",
+      "rnbqkbnr/pppppppp/4q3/8/8/8/PPPPPPPP/RNBQKBNR",
+      "rnbqkbnr/pppppppp/5q2/8/8/8/PPPPPPPP/RNBQKBNR",
+      "rnbqkbnr/pppppppp/6q1/8/8/8/PPPPPPPP/RNBQKBNR",
+      "rnbqkbnr/pppppppp/7q/8/8/8/PPPPPPPP/RNBQKBNR",
+      "rnbqkbnr/pppppppp/8/q7/8/8/PPPPPPPP/RNBQKBNR",
+      "rnbqkbnr/pppppppp/8/1q6/8/8/PPPPPPPP/RNBQKBNR",
+      "rnbqkbnr/pppppppp/8/2q5/8/8/PPPPPPPP/RNBQKBNR",
+      "rnbqkbnr/pppppppp/8/3q4/8/8/PPPPPPPP/RNBQKBNR",
+      "rnbqkbnr/pppppppp/8/4q3/8/8/PPPPPPPP/RNBQKBNR",
+      "rnbqkbnr/pppppppp/8/5q2/8/8/PPPPPPPP/RNBQKBNR",
+      "rnbqkbnr/pppppppp/8/6q1/8/8/PPPPPPPP/RNBQKBNR",
+      "rnbqkbnr/pppppppp/8/7q/8/8/PPPPPPPP/RNBQKBNR",
+      "rnbqkbnr/pppppppp/8/8/q7/8/PPPPPPPP/RNBQKBNR",
+      "rnbqkbnr/pppppppp/8/8/1q6/8/PPPPPPPP/RNBQKBNR",
+      "rnbqkbnr/pppppppp/8/8/2q5/8/PPPPPPPP/RNBQKBNR",
+      "rnbqkbnr/pppppppp/8/8/3q4/8/PPPPPPPP/RNBQKBNR",
+      "rnbqkbnr/pppppppp/8/8/4q3/8/PPPPPPPP/RNBQKBNR"
     };
-    static vector<string> skill (skillFENs, skillFENs + 21);
 
-    unsigned int idx = find (skill.begin (), skill.end (), fen) - skill.begin ();
-    if (idx < skill.size ())
-      {
-        stringstream ss_uci, ss_dgt;
-        ss_uci << "setoption name Skill Level value " << idx;
-        ss_dgt << "lvl" << setw (3) << idx;
-        UCI::loop (ss_uci.str ());
-        dgtnixPrintMessageOnClock (ss_dgt.str ().c_str (), true, false);
-      }
+    for (int level = 0; level <= 20; ++level)
+      addCommand (SkillFENs[level], SET_SKILL, level);
 
-    /*
-    Rank 6: 'Fixed time' or 'Medium Time' 
-    1, 3, 5, 10, 15, 30, 60, 120 seconds 
-    
-    Rank 5: 'Tournament levels' 
-    40/4 (40 moves in 4 minutes), 60/15, 60/30, 30/30, 30/60, , 40/40, 40/120, 40/150 
-    
-    Rank 4: 'Blitz' 
-    1, 3, 5, 10, 15, 30, 60, 90  minutes
-    
-    Rank 3 : 'Blitz Fischer' + 'Special Lvl' 
-    3+2, 3+5, 4+5, 5+1, 15+5, 20+10, opponents average, 1/2 opponents average 
-    --------------------------------------------------------------------------
-    I am thinking for a way to put the time control easily.
-    One option is the following. If you put on the board only the white queen (i think it is the auxiliriary queen that comes with the dgt), the time control is the same for both sides. But if you put also the black queen it indicates handicap level.
-    I think that the handicap level has no sense with Fixed time, that is, 6th rank.
-    In the rest of levels if you put white queen on rank 3,4 or 5, so you can use the 6th rank to put the black queen indicating the time control for black.
-    So the rules are 
-    1) the rank of white queen indicates the type of control, the same for both if you only put the white queen.
-    2) If you put the black queen (always on the 6th rank), you can put different time control for each color.
-    3) the FixedTime levels has no option to specify different times for each color because this levels has no strict control.
-    (Javier's idea)
-    +control opponent's average rate (from 30% to 100%) with black queen on 6th rank
-     */
+    for (int i = 0; i <= MAX_TIME_CONTROL_NUM; ++i)
+      addCommand (TimeControls[i].fen, SET_TIME_CONTROL, i);
 
-    //set time control
-    //fixed time per move modes : 1, 3, 5, 10, 15, 30, 60, 120 seconds
-    setTimeControl(fen, true, false);
+    int bookIdx = 0;
+    for (BookMap::const_iterator it = bookMap.begin (); it != bookMap.end (); ++it)
+      addCommand (it->first, SET_BOOK, bookIdx++);
 
+    // White queen on a5, b5, c5, d5 or e5
+    addCommand ("rnbqkbnr/pppppppp/8/Q7/8/8/PPPPPPPP/RNBQKBNR", SET_PLAY_MODE, BOOK);
+    addCommand ("rnbqkbnr/pppppppp/8/1Q6/8/8/PPPPPPPP/RNBQKBNR", SET_PLAY_MODE, ANALYSIS);
+    addCommand ("rnbqkbnr/pppppppp/8/2Q5/8/8/PPPPPPPP/RNBQKBNR", SET_PLAY_MODE, TRAINING);
+    addCommand ("rnbqkbnr/pppppppp/8/3Q4/8/8/PPPPPPPP/RNBQKBNR", SET_PLAY_MODE, GAME);
+    addCommand ("rnbqkbnr/pppppppp/8/4Q3/8/8/PPPPPPPP/RNBQKBNR", SET_PLAY_MODE, KIBITZ);
 
-    // Select Game modes
-    // White queen on a5
-    if (fen == "rnbqkbnr/pppppppp/8/Q7/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1")
-      {
-        switchToBookMode();
-      }
-    // White queen on b5
-    if (fen == "rnbqkbnr/pppppppp/8/1Q6/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1")
-      {
-        switchToAnalysisMode();
-      }
-    // White queen on c5
-    if (fen == "rnbqkbnr/pppppppp/8/2Q5/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1")
-      {
-        switchToTrainMode();
-      }
-    // White queen on d5
-    if (fen == "rnbqkbnr/pppppppp/8/3Q4/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1")
-      {
-        switchToGameMode();
-      }
-    // White queen on e5
-    if (fen == "rnbqkbnr/pppppppp/8/4Q3/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1")
-      {
-        switchToKibitzMode();
-      }
+    //board orientation
+    addCommand ("RNBKQBNR/PPPPPPPP/8/8/8/8/pppppppp/rnbkqbnr", REVERSE_BOARD);
+    addCommand ("8/8/8/8/8/8/8/q6q", REVERSE_BOARD);
+    addCommand ("Q6Q/8/8/8/8/8/8/8", REVERSE_BOARD);
+
+    // Setup Custom position : white queens on a1 and h1 for white to move,
+    // black queens on a8 and h8 for black to move
+    addCommand ("8/8/8/8/8/8/8/Q6Q", SETUP_POSITION, BLACK);
+    addCommand ("q6q/8/8/8/8/8/8/8", SETUP_POSITION, WHITE);
+
+    //set side to play (simply remove the king of the side you are playing and put it back on the board)
+    addCommand ("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQ1BNR", CHOOSE_SIDE, BLACK);
+    addCommand ("rnbq1bnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR", CHOOSE_SIDE, WHITE);
+
+    addCommand (StartFEN, NEW_GAME);
+
+    addCommand ("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQQBNR", SHUTDOWN);
+    addCommand ("8/8/8/8/8/8/8/3QQ3", SHUTDOWN);
+  }
+
+  void
+  Session::configure (string fen)
+  {
+//        cout << "Fen received: "<< fen;
+    timeControlNum = -1;
 
     if (setupPosition)
       {
@@ -793,70 +1263,81 @@ namespace DGT
         addToFenQueue (fen);
       }
 
-    // Warning need to increment the below number for more book additions to work!
-    BookMap::iterator it = bookMap.find (fen);
-    setOpeningBook(it, true);
+    CommandMap::const_iterator cmd = commands.find (fen_board_key (fen));
+    if (cmd == commands.end ())
+      return;
 
-    //board orientation
-    if (fen == "RNBKQBNR/PPPPPPPP/8/8/8/8/pppppppp/rnbkqbnr w KQkq - 0 1" || fen == "8/8/8/8/8/8/8/q6q w KQkq - 0 1" || fen == "Q6Q/8/8/8/8/8/8/8 w KQkq - 0 1")
+    int arg = cmd->second.arg;
+    switch (cmd->second.type)
       {
-        reverseBoard(); //trigger new game start
-      }
+      case SET_SKILL:
+        {
+          stringstream ss_dgt;
+          ss_dgt << "lvl" << setw (3) << arg;
+          skillLevel = arg;
+          dgtnixPrintMessageOnClock (ss_dgt.str ().c_str (), true, false);
+        }
+        break;
 
-    // Setup Custom position - white to move
-    // White queens on a1 and h1
-    // No beeps as it makes sounds for a FEN setup
-    if (fen == "8/8/8/8/8/8/8/Q6Q w KQkq - 0 1")
-      {
-        dgtnixPrintMessageOnClock (" setup", false, false);
-        setupPosition = true;
-        computerPlays = BLACK;
-        resetClock ();
-      }
+      case SET_TIME_CONTROL:
+        setTimeControl (arg, true);
+        break;
 
-    // Setup Custom position - black to move
-    // Black queens on a8 and h8
-    if (fen == "q6q/8/8/8/8/8/8/8 w KQkq - 0 1")
-      {
+      case SET_BOOK:
+        {
+          // Warning need to increment the below number for more book additions to work!
+          BookMap::iterator it = bookMap.begin ();
+          std::advance (it, arg);
+          setOpeningBook (it, true);
+        }
+        break;
+
+      case SET_PLAY_MODE:
+        if (arg == BOOK) switchToBookMode ();
+        else if (arg == ANALYSIS) switchToAnalysisMode ();
+        else if (arg == TRAINING) switchToTrainMode ();
+        else if (arg == GAME) switchToGameMode ();
+        else switchToKibitzMode ();
+        break;
+
+      case REVERSE_BOARD:
+        reverseBoard (); //trigger new game start
+        break;
+
+      case SETUP_POSITION:
+        // No beeps as it makes sounds for a FEN setup
         dgtnixPrintMessageOnClock (" setup", false, false);
         setupPosition = true;
-        computerPlays = WHITE;
+        computerPlays = Color (arg);
         resetClock ();
-      }
+        break;
 
-    //set side to play (simply remove the king of the side you are playing and put it back on the board)
-    if (fen == "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQ1BNR w KQkq - 0 1")
-      {
-        cout << "You play white" << endl;
-        computerPlays = BLACK;
-      }
-    if (fen == "rnbq1bnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1")
-      {
-        cout << "You play black" << endl;
-        computerPlays = WHITE;
-      }
+      case CHOOSE_SIDE:
+        cout << (arg == BLACK ? "You play white" : "You play black") << endl;
+        computerPlays = Color (arg);
+        break;
 
-    //new game
-    if (fen == StartFEN && !game.empty ())
-      {
-        clearGame ();
-        customPosition = false;
-      }
+      case NEW_GAME:
+        if (!game.empty ())
+          {
+            customPosition = false;
+            clearGame ();
+          }
+        break;
 
-    //shutdown
-    if (fen == "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQQBNR w KQkq - 0 1"
-        || fen == "8/8/8/8/8/8/8/3QQ3 w KQkq - 0 1")
-      {
-        UCI::loop ("stop"); //stop the current search
+      case SHUTDOWN:
+        stopSearch (); //stop the current search
+        pgnWriter->sync (); //the game must be on disk before the power goes off
         if (!system ("shutdown -h now"))
           dgtnixPrintMessageOnClock ("pwroff", true, false);
+        break;
       }
   }
 
   /// Prints a move on the dgt clock
 
-  void
-  printMoveOnClock (Move move, unsigned char beep = true)
+  int
+  printMoveOnClock (Move move, unsigned char beep = true, int priority = DGTNIX_DISPLAY_NORMAL, int duration = DGTNIX_DISPLAY_DURATION)
   {
     //print the move on the clock
     string dgtMove = move_to_uci (move, false);
@@ -864,66 +1345,137 @@ namespace DGT
     if (dgtMove.length () < 6)
       dgtMove.append (" ");
     cout << '[' << dgtMove << ']' << endl;
-    dgtnixPrintMessageOnClock (dgtMove.c_str (), beep, false);
+    return dgtnixScheduleMessageOnClock (dgtMove.c_str (), beep, false, priority, duration);
   }
 
-  /// Test if the given fen is playable in the current game.
-  /// If true, return the move leading to this fen, else return MOVE_NONE
+  /// Time the computer move stays on the clock, longer when the game is over
+  /// so that the move can be read before the result is shown
 
-  Move
-  isPlayable (const string& _fen)
+  int
+  computerMoveDisplayTime (Position& pos)
   {
-    Position pos (getStartFEN (), false, Threads.main()); // The root position
-    stack<StateInfo> states;
-    string fen = _fen.substr (0, _fen.find (' '));
+    if (pos.is_draw () || !MoveList<LEGAL> (pos).size ())
+      return LongDisplayTime;
+    return DGTNIX_DISPLAY_DURATION;
+  }
 
-    //First, we do all the game moves
-    for (vector<Move>::iterator it = game.begin (); it != game.end (); ++it)
-      {
-        states.push (StateInfo ());
-        pos.do_move (*it, states.top ());
-      }
+  /// Test if the given board signature is playable in the current game.
+  /// If true, return the move leading to this board, else return MOVE_NONE
 
-    //Check is the fen is playable in current game position
-    for (MoveList<LEGAL> ml (pos); *ml; ++ml)
-      {
-        StateInfo state;
-        pos.do_move (*ml, state);
-        if (pos.fen ().find (fen) != string::npos)
-          return *ml;
-        pos.undo_move (*ml);
-      }
+  Move
+  Session::isPlayable (Key boardKey)
+  {
+    //Check if the board is one legal move away from the current game position
+    Move move = game.find_move (boardKey);
+    if (move != MOVE_NONE)
+      return move;
 
     //Next we check from the end of the game to the beginning if we reached a position already played
     //If this is the case, we takeback the moves and return MOVE_NONE
-    bool continueSearch = true;
-    for (vector<Move>::reverse_iterator rit = game.rbegin (); rit < game.rend () && continueSearch; ++rit)
+    for (int ply = int(game.size ()) - 1; ply >= 0; --ply)
       {
-        pos.undo_move (*rit);
-        if (pos.side_to_move () != computerPlays) continueSearch = false; //stop searching in the game when we reached a position where human has the move
-        if ((pos.fen ().find (fen) != string::npos) && (pos.side_to_move () != computerPlays || clockMode == INFINITE)) //we found a position that was played
+        Color us = game.side_to_move (ply);
+        if (game.key (ply) == boardKey && (us != computerPlays || clockMode == INFINITE)) //we found a position that was played
           {
-            UCI::loop ("stop"); //stop the current search
-            ponderHitFEN = "";
-            cout << "Rolling back to position" << pos.fen() << endl;
-            dgtnixPrintMessageOnClock (" undo ", true, false);
-            pgnFile << "\n";
-            sleep(1);
-            printMoveOnClock(*(rit+2).base());
-            rewritePGN = true;
-            plyCount = 0;
-            game.erase ((rit + 1).base (), game.end ()); //delete the moves from the game
+            releaseEngine (); //the search may still use the states we take back
+            ponderHitKey = 0;
+            cout << "Rolling back to ply " << ply << endl;
+            dgtnixCancelMessagesOnClock (DGTNIX_DISPLAY_NORMAL); //the moves not displayed yet are taken back
+            dgtnixScheduleMessageOnClock (" undo ", true, false, DGTNIX_DISPLAY_URGENT, DGTNIX_DISPLAY_DURATION);
+            if (ply > 0)
+              printMoveOnClock(game[ply - 1], false); //as the BACK button, no beep: this is not a move to play
+            plyCount = ply;
+            game.truncate (ply); //delete the moves from the game
+            pgnWriter->take_back (ply); //the plies kept are written again with their comments
             if (clockMode == INFINITE) {
                 return MOVE_NULL;
             } else {
                 return MOVE_NONE;
             }
           }
+        if (us != computerPlays) break; //stop searching in the game when we reached a position where human has the move
       }
 
     return MOVE_NONE;
   }
 
+  /// Classify a board against the last stable one. A single piece missing is a
+  /// piece lifted, unless this is a board we are waiting for, as after a capture
+  /// by the computer. Any other difference is a move in progress.
+
+  BoardState
+  Session::classifyBoard (const char* board, Key boardKey, Square& lifted)
+  {
+    int changed = 0, missing = 0;
+    for (int i = 0; i < 64; ++i)
+      if (board[i] != stableBoard[i])
+        {
+          ++changed;
+          if (board[i] == ' ')
+            {
+              ++missing;
+              lifted = Square (i ^ 56); //the dgtnix board array starts from A8
+            }
+        }
+
+    if (!changed)
+      return BOARD_STABLE;
+
+    if (changed == 1 && missing == 1 && boardKey != computerMoveKey && game.find_move (boardKey) == MOVE_NONE)
+      return PIECE_LIFTED;
+
+    return MOVE_IN_PROGRESS;
+  }
+
+  /// When the player lifts a piece, search the game position with only the moves
+  /// of this piece until the move is completed. The positions reached by its
+  /// destinations and our replies are stored in TT, so the search of the computer
+  /// move starts warm. Pondering goes on if the lifted piece is the one expected.
+
+  void
+  Session::startSpeculativeSearch (Square from)
+  {
+    Position& pos = game.position ();
+
+    if (   !Options["DGT Speculative Search"]
+        || searching
+        || clockMode == INFINITE
+        || (playMode != GAME && playMode != BOOK && playMode != KIBITZ)
+        || pos.side_to_move () == computerPlays
+        || from == speculativeFrom)
+      return;
+
+    //The lifted piece is the one of a predicted reply: ponder on this one
+    for (size_t i = 0; ponderHitKey && i < ponderMoves.size (); ++i)
+      if (from_sq (ponderMoves[i]) == from)
+        {
+          if (i != ponderIndex && Engine.owns (events))
+            {
+              stopSearch ();
+              waitSearch ();
+              startPonder (pos, i);
+            }
+          return;
+        }
+
+    vector<Move> searchMoves;
+    for (MoveList<LEGAL> ml (pos); *ml; ++ml)
+      if (from_sq (*ml) == from)
+        searchMoves.push_back (*ml);
+
+    if (searchMoves.empty () || !Engine.acquire (events, SEARCH_BACKGROUND, false))
+      return;
+
+    stopSearch ();
+    ponderHitKey = 0;
+    speculativeFrom = from;
+    speculating = true;
+    Search::LimitsType speculativeLimits;
+    speculativeLimits.infinite = true;
+    cout << "speculative search on " << square_to_string (from) << endl;
+    think (pos, speculativeLimits, searchMoves);
+  }
+
   string
   getDgtTimeString (int time)
   {
@@ -949,7 +1501,7 @@ namespace DGT
   /// Print time on dgt clock
 
   void
-  printTimeOnClock (int wClockTime, int bClockTime, bool wDots = true, bool bDots = true)
+  Session::printTimeOnClock (int wClockTime, int bClockTime, bool wDots, bool bDots)
   {
     string s;
     unsigned char dots = 0;
@@ -989,7 +1541,7 @@ namespace DGT
           }
         else if (wDots) dots |= DGTNIX_RIGHT_SEMICOLON; //hours:minutes mode
       }
-    dgtnixPrintMessageOnClock (s.c_str (), false, dots);
+    dgtnixScheduleMessageOnClock (s.c_str (), false, dots, DGTNIX_DISPLAY_INFO, 0);
   }
 
   void
@@ -1009,9 +1561,13 @@ namespace DGT
 
   }
 
-  void printEngineEvalOnClock()
+  void Session::printEngineEvalOnClock(int priority)
   {
-    string uci_score = Search::UciPvDgt.score;
+    Search::PVInfo pi;
+    if (!analysisPV (pi))
+      return;
+
+    string uci_score = score_to_uci (pi.score);
 
     // Remove the words 'cp' from output and replace with just 'p' (centipawns) to save clock space
     if (uci_score[0] == 'c' && uci_score[1] == 'p')
@@ -1027,54 +1583,54 @@ namespace DGT
     replace (uci_score.begin (), uci_score.end (), '-', 'n'); //Replace minus sign with 'n' as minus sign is not available on DGT
 
     fitStringToDgt (uci_score);
-    dgtnixPrintMessageOnClock (uci_score.c_str (), false, false);
+    dgtnixScheduleMessageOnClock (uci_score.c_str (), false, false, priority, DGTNIX_DISPLAY_DURATION);
   }
 
-  void*
-  wakeUpEverySecond (void*)
+  /// Show the running analysis on the clock. Called at every clock tick, it shows
+  /// in turn the eval, the depth and (in analysis mode) the best move, so that
+  /// each information stays on the display for a full tick.
+
+  void
+  Session::refreshAnalysisDisplay ()
   {
-    while (true)
+    Search::PVInfo pi;
+    if (!((clockMode == INFINITE || playMode == KIBITZ) && searching))
       {
-        sleep (1);
-        sem_post (&dgtnixEventSemaphore);
+        displayPhase = 0;
+        return;
+      }
+    if (!analysisPV (pi))
+      return;
 
-        //        cout <<"Infinite clock mode: "<< clockMode;
-        //        cout <<"\n searching: "<<searching;
-        //        cout <<"\n";
-        if ((clockMode == INFINITE || playMode==KIBITZ) && searching)
+    switch (displayPhase++ % 3)
+      {
+      case 0:
+        printEngineEvalOnClock (DGTNIX_DISPLAY_INFO);
+        break;
+      case 1:
+        // Dont print depth while kibitzing
+        if (playMode != KIBITZ)
           {
-            // Dont show analysis if there is no longer a search
-            if (!searching) continue;
-            sleep (1);
-
-            printEngineEvalOnClock();
             stringstream s_depth;
-            s_depth << Search::UciPvDgt.depth;
-            string depth_str = s_depth.str ();
-            depth_str = 'd' + depth_str; // Add a 'd' in front on depth to make output clear
+            s_depth << pi.depth;
+            string depth_str = 'd' + s_depth.str (); // Add a 'd' in front on depth to make output clear
             fitStringToDgt (depth_str);
-
-            if (playMode !=KIBITZ) {
-                // Dont print depth while kibitzing
-                dgtnixPrintMessageOnClock (depth_str.c_str (), false, false);
-              }
-            //Display the best move computer suggestion only in analysis mode
-            if (playMode == ANALYSIS)
-              {
-                printMoveOnClock (Search::RootMoves[0].pv[0], false);
-              }
-
+            dgtnixScheduleMessageOnClock (depth_str.c_str (), false, false, DGTNIX_DISPLAY_INFO, 0);
           }
-
+        break;
+      case 2:
+        //Display the best move computer suggestion only in analysis mode
+        if (playMode == ANALYSIS)
+          printMoveOnClock (pi.best_move (), false, DGTNIX_DISPLAY_INFO, 0);
+        break;
       }
-    return NULL;
   }
 
   void
-  display_top_book_moves (PolyglotBook& b, const Position& pos, const int num)
+  Session::display_top_book_moves (const Position& pos, const int num)
   {
     // Display top 3 moves in reverse order of strength so that the top move is on the clock. 3 Moves without delay is not that bad
-    vector<Move> book_moves = b.probe_moves (pos, Options["Book File"], num);
+    vector<Move> book_moves = book.probe_moves (pos, bookFile, num);
 
     for (vector<Move>::reverse_iterator it = book_moves.rbegin (); it != book_moves.rend (); ++it)
       {
@@ -1091,15 +1647,10 @@ namespace DGT
   } //returns alternatively true or false every second
 
   string
-  getPgn (Position pos, Move move)
+  Session::getPgn (Position& pos, Move move)
   {
-    //    MoveList<LEGAL> ml(pos); //the legal move list
     std::string pgn;
 
-    // Keep track of position keys along the setup moves (from start position to the
-    // position just before to start searching). Needed by repetition draw detection.
-    Search::StateStackPtr SetupStates = Search::StateStackPtr (new std::stack<StateInfo > ());
-
     // Write header if its the first move
     if (plyCount==0)
       {
@@ -1153,7 +1704,7 @@ namespace DGT
     return pgn;
   }
 
-  void operateBook(MenuOperation mo)
+  void Session::operateBook(MenuOperation mo)
   {
 
     // Warning need to increment the below number for more book additions to work!
@@ -1185,23 +1736,23 @@ namespace DGT
       }
   }
 
-  void operateTimeControl(MenuOperation mo)
+  void Session::operateTimeControl(MenuOperation mo)
   {
     if (mo == INC)
       {
         ++timeControlNum;
         if (timeControlNum>MAX_TIME_CONTROL_NUM) { timeControlNum = 0;}
-        setTimeControl("", false, true);
+        setTimeControl(timeControlNum, false);
       }
     else if (mo == DEC)
       {
         --timeControlNum;
         if (timeControlNum<0) { timeControlNum = MAX_TIME_CONTROL_NUM;}
-        setTimeControl("", false, true);
+        setTimeControl(timeControlNum, false);
       }
     else if (mo == ENABLE)
       {
-        setTimeControl("", true, true);
+        setTimeControl(timeControlNum, true);
         mainMenu = DEFAULT;
       }
 
@@ -1209,7 +1760,7 @@ namespace DGT
 
   }
 
-  void operateLevel(MenuOperation mo)
+  void Session::operateLevel(MenuOperation mo)
   {
     stringstream lvl;
 
@@ -1228,9 +1779,7 @@ namespace DGT
 
     if (mo == ENABLE)
       {
-        stringstream lvl_uci;
-        lvl_uci << "setoption name Skill Level value " << levelNum;
-        UCI::loop (lvl_uci.str ());
+        skillLevel = levelNum;
         dgtnixPrintMessageOnClock ("    ok", true, false);
         mainMenu = DEFAULT;
       }
@@ -1239,7 +1788,7 @@ namespace DGT
     }
   }
 
-  void operateMainMenu()
+  void Session::operateMainMenu()
   {
     int mainMenuItem = (int) mainMenu;
     ++mainMenuItem;
@@ -1252,7 +1801,7 @@ namespace DGT
 
   }
 
-  void operatePositionMenu(MenuOperation mo, string fen)
+  void Session::operatePositionMenu(MenuOperation mo, string fen)
   {
       int posMenuItem = (int) positionMenu;
       if (mo == INC)
@@ -1313,9 +1862,9 @@ namespace DGT
   }
 
   // process clock button action. The fen is passed in for clock button actions that need to fen (such as position setup)
-  void processClockButton(string fen)
+  void Session::processClockButton(string fen, int button)
   {
-    clockButton = (ClockButton) getClockButtonState();
+    clockButton = (ClockButton) button;
 //    cout << "Clock Button ppp: ";
     if (clockButton!=OFF)
       {
@@ -1325,10 +1874,12 @@ namespace DGT
           {
             if (clockButton == DECREASE)
               {
+                Search::PVInfo pi;
                 printEngineEvalOnClock();
                 //            sleep(1);
                 // Display a hint
-                printMoveOnClock(Search::UciPvDgt.ponderMove, false);
+                if (readPV (pi) && pi.ponder_move () != MOVE_NONE)
+                  printMoveOnClock(pi.ponder_move (), false);
 
               }
             else if (clockButton == BACK)
@@ -1359,7 +1910,8 @@ namespace DGT
                   case ANALYSIS:
                     switchToBookMode();
                     // stop the search and restart
-                    Search::Signals.stop = true;
+                    if (Engine.owns (events))
+                      Search::Signals.stop = true;
                     break;
                   case BOOK:
                     switchToTrainMode();
@@ -1367,7 +1919,8 @@ namespace DGT
                   case TRAINING:
                     switchToKibitzMode();
                     // stop the search and restart
-                    Search::Signals.stop = true;
+                    if (Engine.owns (events))
+                      Search::Signals.stop = true;
                     break;
                   case KIBITZ:
                     switchToGameMode();
@@ -1474,27 +2027,37 @@ namespace DGT
       } // If clockbutton !=OFF
   }
 
+  /// Session::run() plays the game of the board until it is disconnected
+
   void
-  loop (const string& args)
+  Session::run ()
   {
     // Initialization
-    pgnFile.open ("game.pgn");
-    computerPlays = BLACK;
-    fixedTime = 5000;
-    clockMode = FIXEDTIME;
-    playMode = GAME;
+    stringstream pgnFile;
+    if (number == 1)
+      pgnFile << "game.pgn";
+    else
+      pgnFile << "game-" << number << ".pgn";
+    pgnWriter = new_thread<PgnWriter> ();
+    pgnWriter->open (pgnFile.str ());
     resetClock (); //search defaults to 5 seconds per move
     Move playerMove = MOVE_NONE;
-    static PolyglotBook book; // Defined static to initialize the PRNG only once
-    Time::point searchStartTime = Time::now ();
-    string computerMoveFEN = "";
+    searchStartTime = Time::now ();
 
-    // DGT Board Initialization
+    // DGT Board Initialization, the first board uses the default dgtnix board
     int BoardDescriptor;
-    char port[256];
+    if (number > 1)
+      dgtBoard = dgtnixNewBoard ();
+    dgtnixSetUserData (this);
     dgtnixSetOption (DGTNIX_DEBUG, DGTNIX_DEBUG_WITH_TIME); //all debug informations are printed
-    strncpy (port, args.c_str (), 256);
-    BoardDescriptor = dgtnixInit (port);
+    dgtnixSetEventCallback (onDgtnixEvent);
+    game.reset (getStartFEN ());
+    events->set_active (true);
+    //"fd:N" is a descriptor already connected to a board, as opened by the replay harness
+    if (!port.compare (0, 3, "fd:"))
+      BoardDescriptor = dgtnixInitDescriptor (atoi (port.c_str () + 3));
+    else
+      BoardDescriptor = dgtnixInit (port.c_str ());
     int err = dgtnix_errno;
     if (BoardDescriptor < 0)
       {
@@ -1511,52 +2074,166 @@ namespace DGT
             cout << "Unrecognized response to the DGT_SEND_BRD message :"
                     << BoardDescriptor << endl;
           }
-        exit (-1);
+        if (number == 1)
+          exit (-1);
+        events->set_active (false);
+        dgtnixClose ();
+        dgtnixDeleteBoard (dgtBoard);
+        delete_thread (pgnWriter);
+        return;
       }
     cout << "The board was found - code: " << BoardDescriptor << endl;
     sleep (3);
     dgtnixUpdate ();
     dgtnixPrintMessageOnClock ("pic017", true, DGTNIX_RIGHT_DOT); //Display version number
 
-    //Engine options
-    UCI::loop ("setoption name Hash value 256");
-    UCI::loop ("setoption name Emergency Base Time value 1300"); //keep 1 second on clock
-    UCI::loop (string ("setoption name Book File value ") + bookPath + "varied.bin"); //default book
-    UCI::loop (string ("setoption name OwnBook value true"));
-
     // Get the first board state
     string currentFEN = getDgtFEN ();
+    stableBoard.assign (dgtnixGetBoard (false), 64);
     configure (currentFEN); //useful for orientation
 
-    // Start the wakeup thread
-    pthread_t wakeUpThread;
-    pthread_create (&wakeUpThread, NULL, wakeUpEverySecond, (void*) NULL);
-
-    // Main DGT event loop
+    // Main DGT event loop. We block until the next event, or until it is time
+    // to refresh the clock display or to hand a settled board to the engine if
+    // nothing happens before.
+    Time::point nextTick = Time::now () + TickInterval;
+    Time::point settleTime = 0; // When the last board change will be settled
+    bool boardPending = false;
     while (true)
       {
-        Position pos;
-        sem_wait (&dgtnixEventSemaphore);
+        Position& pos = game.position (); //the current game position, kept up to date move by move
+        Event event;
+        bool canPonder = false;
+        Time::point now = Time::now ();
+        Time::point deadline = boardPending ? min (nextTick, settleTime) : nextTick;
+        if (now >= deadline || !events->pop (event, int(deadline - now)))
+          {
+            if (boardPending && Time::now () >= settleTime)
+              {
+                event.type = BOARD_SETTLED;
+                boardPending = false;
+                trace->board_settled ();
+              }
+            else
+              {
+                event.type = CLOCK_TICK;
+                nextTick = Time::now () + TickInterval;
+              }
+          }
+        if (event.type == BOARD_CLOSED)
+          {
+            cout << "The board was disconnected" << endl;
+            break;
+          }
+
+        //The shared engine is ours, start the search we are waiting for
+        if (event.type == ENGINE_GRANTED && Engine.owns (events))
+          {
+            if (pendingSearch)
+              launchSearch (pos);
+            else
+              Engine.release (events);
+          }
+
+        //Another board needs the engine: stop our background search, and queue
+        //the analysis again so that it resumes when the engine is back
+        if (event.type == ENGINE_PREEMPTED && Engine.must_yield (events))
+          {
+            cout << "board " << number << " yields the engine" << endl;
+            bool analysing = searching && clockMode == INFINITE;
+            releaseEngine ();
+            ponderHitKey = 0;
+            speculating = false;
+            speculativeFrom = SQ_NONE;
+            if (analysing)
+              {
+                pendingSearch = true;
+                Engine.acquire (events, SEARCH_BACKGROUND);
+              }
+          }
+
         string s = getDgtFEN ();
-        processClockButton(s);
+        const char* board = dgtnixGetBoard (false);
+        Key boardKey = board_key (board);
+        if (event.type == BUTTON_PRESSED)
+          processClockButton (s, event.data);
 
-        //Display time on clock
-        if (clockMode == FIXEDTIME && searching && limits.movetime >= 5000) //If we are in fixed time per move mode, display computer remaining time
+        //Restart the settle window at every board change
+        if (event.type == BOARD_CHANGED)
           {
-            int remainingTime = limits.movetime - (Time::now () - searchStartTime);
-            if (remainingTime >= 1000)
+            Square lifted = SQ_NONE;
+            trace->board_dequeued ();
+            boardState = classifyBoard (board, boardKey, lifted);
+            settleTime = Time::now () + int(Options["DGT Settle Time"]);
+            boardPending = true;
+            if (boardState == PIECE_LIFTED)
+              startSpeculativeSearch (lifted);
+            trace->board_processed ();
+          }
+
+        //A settled board with a piece in the air may be a command, as when a
+        //king is lifted to choose a side, but it is never a position to search
+        if (event.type == BOARD_SETTLED)
+          {
+            Square lifted = SQ_NONE;
+            boardState = classifyBoard (board, boardKey, lifted);
+            if (boardState == PIECE_LIFTED && currentFEN != s)
               {
-                if (computerPlays == WHITE) printTimeOnClock (remainingTime, -1, blink (), false);
-                else printTimeOnClock (-1, remainingTime, false, blink ());
+                currentFEN = s;
+                cout << currentFEN << " (piece lifted)" << endl;
+                configure (currentFEN);
               }
           }
-        else if ((clockMode == BLITZ || clockMode == BLITZFISCHER) && (searching || (computerMoveFENReached && !isPlayable (s)))) //blitz mode and computer or player thinking
+
+        //Refresh the analysis and the time on clock at every clock tick
+        if (event.type == CLOCK_TICK)
           {
-            if (searching != (computerPlays == BLACK)) printTimeOnClock (wTime - (Time::now () - searchStartTime), bTime, blink (), true);
-            else printTimeOnClock (wTime, bTime - (Time::now () - searchStartTime), true, blink ());
+            refreshAnalysisDisplay ();
+            writeLatencyLog (false);
+            Engine.tick ();
+
+            //Ponder on the next predicted reply once the slice is over
+            if (   ponderHitKey && !searching && ponderMoves.size () > 1
+                && Engine.owns (events) && Time::now () >= ponderSliceEnd)
+              {
+                stopSearch ();
+                waitSearch ();
+                startPonder (pos, (ponderIndex + 1) % ponderMoves.size ());
+              }
+
+            //Analyse the next position once the slice is over
+            if (   clockMode == INFINITE && (playMode == ANALYSIS || playMode == TRAINING)
+                && int(Options["DGT Background Analysis"]) && searching && !predicting
+                && !pendingSearch && Engine.owns (events))
+              {
+                cacheAnalysis ();
+                if (Time::now () >= analysisSliceEnd)
+                  {
+                    stopSearch ();
+                    waitSearch ();
+                    if (ponderMoves.empty ())
+                      predictReplies (pos, Options["DGT Background Analysis"]);
+                    else
+                      startAnalysisSlice (pos, (analysisIndex + 1) % (ponderMoves.size () + 1));
+                  }
+              }
+
+            if (clockMode == FIXEDTIME && searching && limits.movetime >= 5000) //If we are in fixed time per move mode, display computer remaining time
+              {
+                int remainingTime = limits.movetime - (Time::now () - searchStartTime);
+                if (remainingTime >= 1000)
+                  {
+                    if (computerPlays == WHITE) printTimeOnClock (remainingTime, -1, blink (), false);
+                    else printTimeOnClock (-1, remainingTime, false, blink ());
+                  }
+              }
+            else if ((clockMode == BLITZ || clockMode == BLITZFISCHER) && (searching || (computerMoveFENReached && !isPlayable (boardKey)))) //blitz mode and computer or player thinking
+              {
+                if (searching != (computerPlays == BLACK)) printTimeOnClock (wTime - (Time::now () - searchStartTime), bTime, blink (), true);
+                else printTimeOnClock (wTime, bTime - (Time::now () - searchStartTime), true, blink ());
+              }
           }
 
-        if (currentFEN != s || refreshPosition)
+        if ((event.type == BOARD_SETTLED && boardState != PIECE_LIFTED && currentFEN != s) || refreshPosition)
           { //There is some change on the DGT board
 //            printf("Some change on board!");
             currentFEN = s;
@@ -1565,16 +2242,17 @@ namespace DGT
 
             configure (currentFEN); //on board configuration
 
-            pos.set(getStartFEN (), false, Threads.main()); // The root position
-
-            if (searching && clockMode == INFINITE)
+            if (searching && clockMode == INFINITE && stableBoard.compare (0, 64, board, 64) && Engine.owns (events))
               {
                 // stop search as a new board position has occurred
+                cacheAnalysis ();
                 Search::Signals.stop = true;
               }
+            stableBoard.assign (board, 64);
+            speculativeFrom = SQ_NONE;
 
             //Test if we reached the computer move fen
-            if (!searching && !computerMoveFENReached && (computerMoveFEN.find (s.substr (0, s.find (' '))) != string::npos))
+            if (!searching && !computerMoveFENReached && computerMoveKey == boardKey)
               {
                 if (playMode!=ANALYSIS && playMode!=TRAINING) {
                     dgtnixPrintMessageOnClock (" done ", true, false);
@@ -1587,8 +2265,10 @@ namespace DGT
               }
 
             //Test if we reach a playable position in the current game
-            Move move = isPlayable (currentFEN);
+            Move move = isPlayable (boardKey);
             cout << "-------------------------Move:" << move << endl;
+            if (move != MOVE_NONE && move != MOVE_NULL)
+              trace->move_recognized (move);
            
             if (move != MOVE_NONE || (!currentFEN.compare (getStartFEN ()) && (computerPlays == WHITE || clockMode == INFINITE)) || refreshPosition)
               {
@@ -1610,82 +2290,57 @@ namespace DGT
                     searchStartTime = Time::now (); //needed if player undoes a move
                   }
 
-                MoveList<LEGAL> ml (pos); //the legal move list
-
-                // Keep track of position keys along the setup moves (from start position to the
-                // position just before to start searching). Needed by repetition draw detection.
-                Search::StateStackPtr SetupStates = Search::StateStackPtr (new std::stack<StateInfo > ());                 
-                
-                //Do all the game moves
-                for (vector<Move>::iterator it = game.begin (); it != game.end (); ++it)
-                  {
-                    SetupStates->push (StateInfo ());
-                    // In INFINITE analysis/training mode, every move is a player move and thus there is no need to write
-                    // the move from the game move list
-                    if (rewritePGN)
-                      {
-                        Move m = *it;
-                        pgnFile << getPgn( pos, m);
-                        pgnFile.flush();
-                        // pubsync() Needed for raspberry pi
-                        // pgnFile.rdbuf()->pubsync();
-                      }
-                    pos.do_move (*it, SetupStates->top ());
-                    
-                  }
-                if (rewritePGN) rewritePGN = false;
-                   
+                //Write again the game if some moves were taken back
+                //Do the board move in the game
                 if (move != MOVE_NONE)
                   {
-                    SetupStates->push (StateInfo ());
-                    if (!Search::UciPvDgt.score.empty ()) {
-                        pgnFile << " { "<< Search::UciPvDgt.score<< " depth "<<Search::UciPvDgt.depth<< " } ("<<Search::UciPvDgt.pv << " ) ";
+                    Search::PVInfo pi;
+                    if (!speculating && analysisPV (pi)) {
+                        stringstream comment;
+                        comment << " { "<< score_to_uci (pi.score) << " depth "<< pi.depth << " } ( ";
+                        for (int i = 0; i < pi.pvLength; i++)
+                          comment << move_to_uci (pi.pv[i], false) << " ";
+                        comment << ") ";
+                        pgnWriter->append (comment.str ());
                       }
-                    pgnFile << getPgn( pos, playerMove);
-                    pgnFile.flush();
-                    // pubsync() Needed for raspberry pi
-                    // pgnFile.rdbuf()->pubsync();
-                    pos.do_move (playerMove, SetupStates->top ()); //Do the board move
+                    pgnWriter->append_move (getPgn( pos, playerMove));
+                    game.push_back (playerMove);
                   }
 
+                MoveList<LEGAL> ml (pos); //the legal move list
+
                 //Add fischer increment time to the computer's clock
                 if (computerPlays == WHITE) wTime += fischerInc;
                 else bTime += fischerInc;
 
                 //Check if we can find a move in the book
-                Move bookMove = book.probe (pos, Options["Book File"], Options["Best Book Move"]);
-                if (bookMove && Options["OwnBook"])
+                Move bookMove = book.probe (pos, bookFile, Options["Best Book Move"]);
+                trace->stamp (LAT_BOOK);
+                if (bookMove && ownBook)
                   {
-                    UCI::loop ("stop");
+                    stopSearch ();
                     searching = false;
                     dgtnixPrintMessageOnClock ("  book", false, false); //don't play immediately, wait for 1 second
-                    //do the moves in the game
-                    if (playerMove != MOVE_NONE) game.push_back (playerMove);
 
                     if (playMode != GAME && playMode != BOOK && playMode != KIBITZ)
                       {
-                        display_top_book_moves (book, pos, 3);
+                        display_top_book_moves (pos, 3);
                       }
 
                     else
                       {
-                        printMoveOnClock (bookMove);
+                        pgnWriter->append_move (getPgn( pos, bookMove));
                         game.push_back (bookMove);
-                        pgnFile << getPgn( pos, bookMove);
-                        pgnFile.flush();
+                        trace->scheduled (printMoveOnClock (bookMove, true, DGTNIX_DISPLAY_NORMAL,
+                                                             playMode == BOOK ? LongDisplayTime : computerMoveDisplayTime (pos)));
 
                         if (playMode == BOOK)
-                          {
-                            pos.do_move (bookMove, SetupStates->top ());
-                            sleep (3);
-                            display_top_book_moves (book, pos, 3);
-                          }
+                          display_top_book_moves (pos, 3);
 
                       } // Show computer book moves in non game mode
                     // In book mode, only the the player's book moves are shown!
 
-                    if (!Search::RootMoves.empty ()) Search::RootMoves[0].pv[1] = MOVE_NONE; //No pondering
-                    goto finishSearch;
+                    goto finishSearch; //No pondering
                   }
                   //Check for a draw : whether the position is drawn by material repetition, or the 50 moves rule.
                   //It does not detect stalemates
@@ -1696,36 +2351,30 @@ namespace DGT
                   {
                       //sleep(1); //don't play immediately, wait for 1 second
                                   printMoveOnClock(ml.move());
-                                          //do the moves in the game
-                                          if(playerMove!=MOVE_NONE) game.push_back(playerMove);
+                                          //do the move in the game
                                           game.push_back(ml.move());
                       goto finishSearch;
                   }*/
                 else if (ml.size ()) //Launch the search if there are legal moves
                   {
                     searchStartTime = Time::now ();
-                    if (ponderHitFEN.find (currentFEN.substr (0, currentFEN.find (' '))) != string::npos /*&& Search::Signals.stop == false*/)
+                    if (ponderHitKey)
+                      {
+                        ponderTries++;
+                        ponderHits += (isPonderMove (boardKey) != MOVE_NONE);
+                        cout << "ponder hits " << ponderHits << "/" << ponderTries << endl;
+                      }
+                    if (   ponderHitKey && ponderHitKey == boardKey /*&& Search::Signals.stop == false*/
+                        && Engine.acquire (events, SEARCH_MOVE, false)) //the ponder search is ours, raise its priority
                       {
                         cout << "ponderhit!!" << endl;
                         Search::Limits.ponder = false;
                         // Instead of calling UCI::loop ("ponderhit"), setting Search::Limits.ponder avoids multi-threaded issues when playing a timed game
                         // UCI::loop ("ponderhit");
+                        trace->stamp (LAT_SEARCH_START);
                       }
                     else
-                      {
-                        UCI::loop ("stop");
-                        //set time limits
-                        if (clockMode == BLITZ || clockMode == BLITZFISCHER)
-                          {
-                            limits.time[WHITE] = max (wTime, 0);
-                            limits.time[BLACK] = max (bTime, 0);
-                            limits.inc[WHITE] = limits.inc[BLACK] = fischerInc;
-                          }
-                        limits.ponder = false;
-                        ponderHitFEN = "";
-                        cout << "launch serach!!" << endl;
-                        Threads.start_thinking (pos, limits, vector<Move > (), SetupStates);
-                      }
+                      startSearch (pos);
                     searching = true;
                   }
                 else //no move to play : we are mate or stalemate
@@ -1737,82 +2386,149 @@ namespace DGT
               } // end if computerPlays == WHITE
           }
 
+        //The replies to ponder on are found
+        if (predicting && Search::Signals.stop == true && Engine.owns (events))
+          {
+            Threads.wait_for_think_finished ();
+            collectPredictions (pos);
+          }
+
         //Check for finished search
-        if (Search::Signals.stop == true && searching)
+        if (Search::Signals.stop == true && searching && Engine.owns (events) && !pendingSearch)
           {
             cout << "Finished search";
             searching = false;
+            canPonder = true;
+            trace->stamp (LAT_SEARCH);
 
             //update clock remaining time
             if (computerPlays == WHITE) wTime -= (Time::now () - searchStartTime);
             else bTime -= (Time::now () - searchStartTime);
 
             cout << "stopped with move " << move_to_uci (Search::RootMoves[0].pv[0], false) << endl;
-            //do the moves in the game
-            if (playerMove != MOVE_NONE) game.push_back (playerMove);
-
+            //do the computer move in the game, the player move is already there
             if (clockMode != INFINITE)
               {
-                printMoveOnClock (Search::RootMoves[0].pv[0]);
+                pgnWriter->append_move (getPgn( pos, Search::RootMoves[0].pv[0]));
                 game.push_back (Search::RootMoves[0].pv[0]);
-                pgnFile << getPgn( pos, Search::RootMoves[0].pv[0]);
-                pgnFile.flush();
+                trace->scheduled (printMoveOnClock (Search::RootMoves[0].pv[0], true, DGTNIX_DISPLAY_NORMAL, computerMoveDisplayTime (pos)));
 
               }
 
 finishSearch:
-            //set the FEN we are waiting ofr on the board
-            pos.set(getStartFEN (), false, Threads.main()); // The root position
-            // Keep track of position keys along the setup moves (from start position to the
-            // position just before to start searching). Needed by repetition draw detection.
-            Search::StateStackPtr SetupStates = Search::StateStackPtr (new std::stack<StateInfo > ());
-            ;
-            //Do all the game moves
-            for (vector<Move>::iterator it = game.begin (); it != game.end (); ++it)
-              {
-                SetupStates->push (StateInfo ());
-                pos.do_move (*it, SetupStates->top ());
-              }
-            computerMoveFEN = pos.fen();
+            //set the board we are waiting for on the DGT board
+            computerMoveKey = game.key (game.size ());
             computerMoveFENReached = false;
+            ponderHitKey = 0;
 
             MoveList<LEGAL> ml (pos); //the legal move list
             //check for draw
             if (pos.is_draw())
-              {
-                sleep (3);
-                dgtnixPrintMessageOnClock ("  draw", true, false);
-              }
+              dgtnixPrintMessageOnClock ("  draw", true, false);
               //check for mate or stalemate
             else if (!ml.size ())
               {
-                sleep (3);
                 if (pos.checkers()) dgtnixPrintMessageOnClock ("  mate", true, false);
                 else dgtnixPrintMessageOnClock ("stlmat", true, false);
               }
               //Ponder
-            else if ((playMode == GAME || playMode == BOOK || playMode == KIBITZ) && !Search::RootMoves.empty () && Search::RootMoves[0].pv[1] != MOVE_NONE)
+            else if (   (playMode == GAME || playMode == BOOK || playMode == KIBITZ)
+                     && canPonder
+                     && !Engine.contended () //a board waits for the engine, let it go
+                     && !Search::RootMoves.empty () && Search::RootMoves[0].pv[1] != MOVE_NONE)
               {
-                game.push_back (Search::RootMoves[0].pv[1]);
-                pos.do_move (Search::RootMoves[0].pv[1], SetupStates->top ());
-                ponderHitFEN = pos.fen();
-                //Launch ponder search
-                if (clockMode == BLITZ || clockMode == BLITZFISCHER)
+                //a stopped search may not have returned yet and still use the game position
+                Threads.wait_for_think_finished ();
+                if (int(Options["DGT Ponder Candidates"]) > 1)
+                  predictReplies (pos, Options["DGT Ponder Candidates"]);
+                else
                   {
-                    limits.time[WHITE] = max (wTime, 0);
-                    limits.time[BLACK] = max (bTime, 0);
-                    limits.inc[WHITE] = limits.inc[BLACK] = fischerInc;
+                    ponderMoves.assign (1, Search::RootMoves[0].pv[1]); //RootMoves is reset by the ponder search
+                    game.do_ponder_move (ponderMoves[0]);
+                    ponderKeys.assign (1, board_key (pos));
+                    game.undo_ponder_move (ponderMoves[0]);
+                    startPonder (pos, 0);
                   }
-                limits.ponder = true;
-                Threads.start_thinking(pos, limits, vector<Move > (), SetupStates);
-                game.pop_back ();
               }
-            else ponderHitFEN = "";
+            else ponderHitKey = 0;
+
+            if (!ponderHitKey && !predicting)
+              releaseEngine (); //nothing more to search until the player moves
           }
 
       }
 
+    releaseEngine ();
+    events->set_active (false);
     dgtnixClose ();
+    dgtnixDeleteBoard (dgtBoard);
+    delete_thread (pgnWriter);
+  }
+
+  /// SessionThread runs the session of a board other than the first one
+
+  struct SessionThread : public ThreadBase
+  {
+    SessionThread () : session (NULL), started (false) {}
+    virtual void idle_loop ();
+    void start (Session* s);
+
+    Session* session;
+    volatile bool started;
+  };
+
+  void
+  SessionThread::start (Session* s)
+  {
+    session = s;
+    started = true;
+    notify_one ();
+  }
+
+  void
+  SessionThread::idle_loop ()
+  {
+    wait_for (started);
+    session->run ();
+    delete session;
+  }
+
+  /// DGT::loop() plays on the boards of the given ports, separated by spaces.
+  /// The first board is played on the calling thread and the call returns when
+  /// all the boards are disconnected.
+
+  void
+  loop (const string& args)
+  {
+    istringstream is (args);
+    vector<string> ports;
+    string port;
+    while (is >> port)
+      ports.push_back (port);
+    if (ports.empty ())
+      return;
+
+    init_board_keys ();
+    init_commands ();
+    Sessions = int(ports.size ());
+
+    //Engine options, shared by all the boards
+    UCI::loop ("setoption name Hash value 256");
+    UCI::loop ("setoption name Emergency Base Time value 1300"); //keep 1 second on clock
+
+    vector<SessionThread*> threads;
+    for (size_t i = 1; i < ports.size (); ++i)
+      {
+        threads.push_back (new_thread<SessionThread> ());
+        threads.back ()->start (new Session (int(i) + 1, ports[i]));
+      }
+
+    Session* first = new Session (1, ports[0]);
+    first->run ();
+    delete first;
+
+    for (size_t i = 0; i < threads.size (); ++i)
+      delete_thread (threads[i]);
   }
 
 }
@@ -0,0 +1,120 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2012 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2012 Jean-Francois Romang
+  Copyright (C) 2012-2013 Shivkumar Shivaji
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DGT_H_INCLUDED
+#define DGT_H_INCLUDED
+
+#include <deque>
+#include <string>
+
+#include "thread.h"
+
+namespace DGT {
+
+/// Events handled by the DGT main loop. BOARD_CHANGED, BUTTON_PRESSED and
+/// BOARD_CLOSED come from the dgtnix driver thread, SEARCH_FINISHED from the
+/// search, ENGINE_GRANTED and ENGINE_PREEMPTED from the shared engine. CLOCK_TICK
+/// and BOARD_SETTLED are generated by the loop itself when no other event
+/// arrives in time, the latter once the board did not change for the settle
+/// window. BOARD_CLOSED ends the loop.
+
+enum EventType {
+  BOARD_CHANGED, BUTTON_PRESSED, SEARCH_FINISHED, CLOCK_TICK, BOARD_SETTLED,
+  BOARD_CLOSED, ENGINE_GRANTED, ENGINE_PREEMPTED
+};
+
+struct Event {
+  EventType type;
+  int data; // Clock button for BUTTON_PRESSED, unused otherwise
+};
+
+
+/// EventQueue is a thread safe FIFO with a blocking, timed pop(). Events are
+/// accepted only while the queue is active, so that a plain UCI session does
+/// not accumulate SEARCH_FINISHED events nobody will ever read.
+
+struct EventQueue {
+
+  EventQueue() : active(false) {}
+
+  void push(EventType type, int data = 0);
+  bool pop(Event& e, int msec);
+  void set_active(bool b);
+
+private:
+  Mutex mutex;
+  ConditionVariable sleepCondition;
+  std::deque<Event> events;
+  volatile bool active;
+};
+
+
+/// SharedEngine lets the sessions of several boards share the search threads
+/// and the transposition table. One search runs at a time, started by the
+/// session owning the engine, whose event queue identifies it. A session that
+/// finds the engine busy is queued and receives ENGINE_GRANTED when its turn
+/// comes, timed move searches first. A background search (pondering,
+/// speculative search or infinite analysis) receives ENGINE_PREEMPTED when a
+/// move search is queued, or when other sessions waited for a time slice, and
+/// must then stop and release the engine.
+
+enum SearchPriority { SEARCH_BACKGROUND, SEARCH_MOVE };
+
+struct SharedEngine {
+
+  SharedEngine() : owner(NULL), lastClient(NULL), preempting(false), searchId(0) {}
+
+  bool acquire(EventQueue* q, SearchPriority p, bool wait = true);
+  void release(EventQueue* q);
+  bool owns(EventQueue* q) const { return owner == q; }
+  bool must_yield(EventQueue* q) const { return owner == q && preempting; }
+  bool contended();
+  int new_search(EventQueue* q);
+  int search_id() const { return searchId; }
+  void search_finished();
+  void tick();
+
+private:
+  struct Request {
+    EventQueue* queue;
+    SearchPriority priority;
+  };
+
+  void preempt();
+
+  Mutex mutex;
+  std::deque<Request> requests;
+  EventQueue* volatile owner;
+  EventQueue* lastClient;
+  SearchPriority ownerPriority;
+  Time::point grantTime;
+  volatile bool preempting;
+  volatile int searchId;
+};
+
+extern EventQueue Events;
+extern SharedEngine Engine;
+
+void loop(const std::string& args);
+
+} // namespace DGT
+
+#endif // #ifndef DGT_H_INCLUDED
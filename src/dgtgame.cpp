@@ -0,0 +1,206 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2012 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2012 Jean-Francois Romang
+  Copyright (C) 2012-2013 Shivkumar Shivaji
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cassert>
+
+#include "dgtgame.h"
+#include "movegen.h"
+#include "rkiss.h"
+#include "thread.h"
+
+using std::string;
+
+namespace {
+
+  // Same piece letters as in a FEN string and in the dgtnix board array
+  const string PieceToChar(" PNBRQK  pnbrqk");
+
+  Key PieceKeys[PIECE_NB][SQUARE_NB];
+
+  // The dgtnix board array starts from A8, Stockfish squares from A1
+  inline Square dgt_to_square(int idx) { return Square(idx ^ 56); }
+}
+
+namespace DGT {
+
+/// init_board_keys() fills the piece-square random table used by board_key()
+
+void init_board_keys() {
+
+  RKISS rk(29);
+
+  for (Piece p = W_PAWN; p <= B_KING; p++)
+      for (Square s = SQ_A1; s <= SQ_H8; s++)
+          PieceKeys[p][s] = rk.rand<Key>();
+
+  for (Square s = SQ_A1; s <= SQ_H8; s++)
+      PieceKeys[NO_PIECE][s] = 0;
+}
+
+
+/// board_key() computes the signature of a dgtnix board array, as returned by
+/// dgtnixGetBoard(), or of the piece placement of a position. fen_board_key()
+/// does the same from a FEN string, that needs not be a legal position.
+
+Key board_key(const char* dgtBoard) {
+
+  Key k = 0;
+
+  for (int i = 0; i < 64; i++)
+      if (dgtBoard[i] != ' ')
+      {
+          size_t p = PieceToChar.find(dgtBoard[i]);
+          if (p != string::npos)
+              k ^= PieceKeys[p][dgt_to_square(i)];
+      }
+
+  return k;
+}
+
+Key board_key(const Position& pos) {
+
+  Key k = 0;
+  Bitboard b = pos.pieces();
+
+  while (b)
+  {
+      Square s = pop_lsb(&b);
+      k ^= PieceKeys[pos.piece_on(s)][s];
+  }
+
+  return k;
+}
+
+Key fen_board_key(const string& fen) {
+
+  Key k = 0;
+  int idx = 0; // FEN ranks are listed from A8, like the dgtnix board array
+
+  for (size_t i = 0; i < fen.size() && fen[i] != ' ' && idx < 64; i++)
+  {
+      char c = fen[i];
+
+      if (c >= '1' && c <= '8')
+          idx += c - '0';
+
+      else if (c != '/')
+      {
+          size_t p = PieceToChar.find(c);
+          if (p != string::npos)
+              k ^= PieceKeys[p][dgt_to_square(idx)];
+          idx++;
+      }
+  }
+
+  return k;
+}
+
+
+/// GameState::reset() starts a new game from the given FEN
+
+void GameState::reset(const string& fen) {
+
+  startFen = fen;
+  pos.set(fen, false, Threads.main());
+  startColor = pos.side_to_move();
+  moves.clear();
+  keys.assign(1, board_key(pos));
+  successorsDirty = true;
+}
+
+
+/// GameState::push_back() and GameState::pop_back() advance and retract the
+/// game by one ply. A running search may reference the states of the moves
+/// still in the game, so a retracted state must not be reused before the
+/// search has finished.
+
+void GameState::push_back(Move m) {
+
+  assert(moves.size() < size_t(MAX_GAME_PLY));
+
+  pos.do_move(m, states[moves.size()]);
+  moves.push_back(m);
+  keys.push_back(board_key(pos));
+  successorsDirty = true;
+}
+
+void GameState::pop_back() {
+
+  pos.undo_move(moves.back());
+  moves.pop_back();
+  keys.pop_back();
+  successorsDirty = true;
+}
+
+void GameState::truncate(size_t ply) {
+
+  while (moves.size() > ply)
+      pop_back();
+}
+
+
+/// GameState::do_ponder_move() plays the move we ponder on using a dedicated
+/// state, so that the ponder search history is not overwritten when the player
+/// move is added to the game. Each predicted reply has its own slot. Must be
+/// undone before the game is changed.
+
+void GameState::do_ponder_move(Move m, int slot) {
+
+  assert(slot >= 0 && slot < MAX_PONDER_MOVES);
+
+  pos.do_move(m, ponderStates[slot]);
+}
+
+void GameState::undo_ponder_move(Move m) {
+
+  pos.undo_move(m);
+}
+
+
+/// GameState::find_move() returns the legal move leading from the last game
+/// position to a board with the given signature, or MOVE_NONE if there is none.
+/// Successors are computed once per ply.
+
+Move GameState::find_move(Key boardKey) {
+
+  if (successorsDirty)
+  {
+      StateInfo st;
+      successors.clear();
+
+      for (MoveList<LEGAL> ml(pos); *ml; ++ml)
+      {
+          pos.do_move(*ml, st);
+          successors.push_back(std::make_pair(board_key(pos), *ml));
+          pos.undo_move(*ml);
+      }
+
+      successorsDirty = false;
+  }
+
+  for (size_t i = 0; i < successors.size(); i++)
+      if (successors[i].first == boardKey)
+          return successors[i].second;
+
+  return MOVE_NONE;
+}
+
+} // namespace DGT
@@ -0,0 +1,96 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2012 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2012 Jean-Francois Romang
+  Copyright (C) 2012-2013 Shivkumar Shivaji
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DGTGAME_H_INCLUDED
+#define DGTGAME_H_INCLUDED
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "position.h"
+#include "types.h"
+
+namespace DGT {
+
+/// A board signature is a Zobrist key of the piece placement only. Side to
+/// move, castling rights and en passant square are unknown to the DGT board,
+/// so they are left out and a board array, a Position and the piece placement
+/// field of a FEN string can be compared.
+
+void init_board_keys();
+Key board_key(const char* dgtBoard);
+Key board_key(const Position& pos);
+Key fen_board_key(const std::string& fen);
+
+
+/// GameState holds the game played on the board: the moves, a live Position
+/// at the last ply and the board signature reached after each ply. The states
+/// of the game moves live in a preallocated arena, so advancing or retracting
+/// a ply is a single do_move() or undo_move() and positions handed to the
+/// search keep a valid history for repetition detection. Recognizing a board
+/// move or a takeback is a matter of comparing keys, whatever the length of
+/// the game.
+
+const int MAX_GAME_PLY = 2048;
+const int MAX_PONDER_MOVES = 4;
+
+class GameState {
+public:
+  typedef std::vector<Move>::const_iterator const_iterator;
+
+  GameState() : successorsDirty(true) {}
+
+  void reset(const std::string& fen);
+  void push_back(Move m);
+  void pop_back();
+  void truncate(size_t ply);
+  void do_ponder_move(Move m, int slot = 0);
+  void undo_ponder_move(Move m);
+
+  bool empty() const { return moves.empty(); }
+  size_t size() const { return moves.size(); }
+  Move back() const { return moves.back(); }
+  Move operator[](size_t ply) const { return moves[ply]; }
+  const_iterator begin() const { return moves.begin(); }
+  const_iterator end() const { return moves.end(); }
+  const std::string& start_fen() const { return startFen; }
+  Position& position() { return pos; }
+
+  Key key(size_t ply) const { return keys[ply]; }
+  Color side_to_move(size_t ply) const { return ply & 1 ? ~startColor : startColor; }
+  Move find_move(Key boardKey);
+
+private:
+  std::string startFen;
+  Position pos;
+  StateInfo states[MAX_GAME_PLY];
+  StateInfo ponderStates[MAX_PONDER_MOVES];
+  std::vector<Move> moves;
+  std::vector<Key> keys;
+  std::vector<std::pair<Key, Move> > successors;
+  Color startColor;
+  bool successorsDirty;
+};
+
+} // namespace DGT
+
+#endif // #ifndef DGTGAME_H_INCLUDED
@@ -40,6 +40,7 @@
 #include <string.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/epoll.h>
 
 /* Includes for the virtual board socket
  */
@@ -57,8 +58,6 @@
 #include "dgtnix.h"
 
 int dgtnix_errno=0;
-int clockButtonState;
-sem_t dgtnixEventSemaphore;
 
 /* The version of the dgtnix driver version as returned by the dgtnixQueryDriverVersion() function */
 /* #define _DGTNIX_DRIVER_VERSION  "1.81" */
@@ -126,12 +125,24 @@ sem_t dgtnixEventSemaphore;
 
 /* Size of the internal g_readBuffer array */
 #define READBUFFERSIZE 512
+/* Size of the ring buffer receiving the chars read on the board-driver file,
+   must be a power of two */
+#define RINGBUFFERSIZE 1024
+/* Size of the buffer of the commands waiting to be written to the board */
+#define WRITEBUFFERSIZE 256
 
 /* Messages sent to the clock */
 #define _DGTNIX_CLOCK_MESSAGE   0x2b
 #define _DGTNIX_CMD_CLOCK_DISPLAY  0x01
 #define _DGTNIX_CMD_CLOCK_ICONS    0x02
 #define _DGTNIX_CMD_CLOCK_END      0x03
+#define _DGTNIX_SIZE_CLOCK_MESSAGE 13
+/* Maximum number of clock messages waiting to be displayed, the oldest
+   message of the lowest priority is dropped when the queue is full */
+#define _DGTNIX_CLOCK_QUEUE_SIZE 16
+/* Time to wait for the clock ACK before sending a message again (ms) */
+#define _DGTNIX_CLOCK_ACK_TIMEOUT 1000
+#define _DGTNIX_CLOCK_MAX_RETRIES 5
 
 /*********************************/
 /* Intern functions declarations */
@@ -139,6 +150,11 @@ sem_t dgtnixEventSemaphore;
 static void* _threadManagedFunc(void *);
 static void _sendMessageToBoard(int);
 static int _readMessageFromBoard();
+static int _fillRingBuffer();
+static int _flushWrites();
+static void _queueWrite(const unsigned char *, size_t);
+static void _wakeDriver();
+static long long _now();
 static void _sendMessageToEngine(const char*, size_t);
 static int _debug(const char *, ...);
 static int _closeDescriptor(int *);
@@ -152,68 +168,184 @@ static void _bwtimeReceived(unsigned char [6]);
 static void _assertDriverInitialised(const char *);
 static int _setTTY(const char *);
 static int _setUnixSocket(const char *);
+static int _startDriver(const char *);
 static void _setBoardOrientation(unsigned int orientation);
 static void _setDebugMode(unsigned int value);
+static void _notifyEngine(int);
 /****************************************/
 /* Intern global variables declarations */
 /****************************************/
-/* Internal representation of the board, synced with DGT */
-static char g_board[64];
-/* The board returned by dgtnixGetBoard(). It is a copy of g_board but 
-   converted with _convertInternalPieceToExternal(...) */
-static char g_transmitedBoard[64];
 /* The string to print before the debug message */
 static const char *g_debugString="dgtnix-debug:";
-/* Descriptor for the running thread */
-static pthread_t g_driverThread;
-/* Buffer for the chars read on the board-driver file */
-static unsigned char g_readBuffer[READBUFFERSIZE];
-/* Descriptor of the  board-driver communication file */
-static int g_descriptorDriverBoard=-1;
-/* Descriptor of the communication file as returned by dgtnixInit(...) */
-static int g_pipeEngineReadSide=-1;
-/* Descriptor of the communication file on the driver to the engine side */ 
-static int g_pipeDriverWriteSide=-1;
-/* Buffer to store the serial number, returned by dgtnixQueryString(DGTNIX_SERIAL_STRING) */
-static char g_serialBuffer[_DGTNIX_SIZE_SERIALNR+1];
-/* Buffer to store the version of the board, returned by dgtnixQueryString(DGTNIX_VERSION_STRING) */
-static char g_versionBuffer[_DGTNIX_SIZE_VERSION+1];
-/* Buffer to store the bus adress of the board, returned by dgtnixQueryString(DGTNIX_BUSADDRESS_STRING) */
-static char g_busadressBuffer[_DGTNIX_SIZE_BUSADDRESS+1];
-/* Buffer to store the trademark of the board, returned by dgtnixQueryString(DGTNIX_TRADEMARK_STRING) */
-static char g_trademarkBuffer[257];
-/* Flag to test wether the version string was already queryed to the board */
-static char g_versionFlag;
-/* Flag to test wether the serial string was already queryed to the board */
-static char g_serialFlag;
-/* Flag to test wether the trademark string was already queryed to the board */
-static char g_trademarkFlag;
-/* Flag to test wether the busadress string was already queryed to the board */
-static char g_busadressFlag;
-/* Flag for the verbose debug mode */
-static char g_debugMode=DGTNIX_DEBUG_OFF;
-/* Flag set to the real board or the virtual board */
-static char g_virtualBoardMode=_DGTNIX_REAL_BOARD;
-/* Used by dgtnixGetBoard(...), 
-   if the board has not changed it is not necessary to copy g_board to g_transmitedBoard */
-static char g_boardUpdated;
-/* The time received from the DGT clock for white player (in seconds) */
-static  int g_wtime;
-/* The time received from the DGT clock for black player (in seconds) */
-static int g_btime;
-/* Regarding the button pressed on the DGT clock, wether it is white turn's or not */
-static  int g_wturn;
-/* Control the orientation of the board, can be DGTNIX_BOARD_ORIENTATION_CLOCKLEFT or DGTNIX_BOARD_ORIENTATION_CLOCKRIGHT */
-static  char g_boardOrientation=DGTNIX_BOARD_ORIENTATION_CLOCKLEFT;
-/* simply ensure that the driver was initialised with dgtnixInit( ... ) */
-static char g_initialised=0;
-/* This mutex is used by to ensure that during a dgtnixGetBoard(...) call, the board is'nt updated */
-static pthread_mutex_t g_mutex = PTHREAD_MUTEX_INITIALIZER;
-/* This mutex is used tu ensure we have recieved a clock ack message */
-static pthread_mutex_t clock_ack_mutex = PTHREAD_MUTEX_INITIALIZER;
-
-/* This mutex is used to ensure that multiple threads can send messages to the clock. */
-static pthread_mutex_t clock_send_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* A clock message waiting to be sent */
+typedef struct
+{
+  unsigned char message[_DGTNIX_SIZE_CLOCK_MESSAGE];
+  int priority;
+  int duration;
+  int id;
+} _ClockEntry;
+/* The state of one board and of its driver thread. Several boards can be
+   driven at once, the dgtnix... functions work on the board of the calling
+   thread, see dgtnixNewBoard() and dgtnixSelectBoard(). The driver thread
+   of a board works on that board. */
+typedef struct _dgtnixBoard
+{
+  /* Internal representation of the board, synced with DGT */
+  char board[64];
+  /* The board returned by dgtnixGetBoard(). It is a copy of g_board but 
+     converted with _convertInternalPieceToExternal(...) */
+  char transmitedBoard[64];
+  /* Descriptor for the running thread */
+  pthread_t driverThread;
+  /* Payload of the last message read from the board */
+  unsigned char readBuffer[READBUFFERSIZE];
+  /* Ring buffer of the chars read on the board-driver file and not yet framed.
+     g_ringHead and g_ringTail are free running, the ring holds g_ringTail - g_ringHead chars */
+  unsigned char ringBuffer[RINGBUFFERSIZE];
+  size_t ringHead;
+  size_t ringTail;
+  /* Commands waiting to be written to the board, written by the driver thread only */
+  unsigned char writeBuffer[WRITEBUFFERSIZE];
+  size_t writeLength;
+  /* Clock messages waiting to be sent, in the order they were scheduled. They
+     are sent one at a time, highest priority first, each one after the ACK of
+     the previous one and once the previous one was displayed long enough */
+  _ClockEntry clockQueue[_DGTNIX_CLOCK_QUEUE_SIZE];
+  int clockQueueCount;
+  /* The last clock message sent, kept to be sent again if no ACK is received,
+     and the minimum time it stays displayed (ms) */
+  unsigned char clockMessage[_DGTNIX_SIZE_CLOCK_MESSAGE];
+  int clockDuration;
+  /* Identifier of the last clock message sent, and of the last one scheduled */
+  int clockMessageId;
+  int lastClockId;
+  int clockAckPending;
+  int clockRetries;
+  long long clockSentTime;
+  /* The epoll instance of the driver thread, watching the board and the wakeup pipe */
+  int epollDescriptor;
+  /* Written to wake up the driver thread when there is something to write, or to stop it */
+  int wakeupPipe[2];
+  /* Set when the board descriptor is also watched for EPOLLOUT */
+  int epollOut;
+  /* Cleared by dgtnixClose() to stop the driver thread */
+  volatile int driverRunning;
+  /* Descriptor of the  board-driver communication file */
+  int descriptorDriverBoard;
+  /* Descriptor of the communication file as returned by dgtnixInit(...) */
+  int pipeEngineReadSide;
+  /* Descriptor of the communication file on the driver to the engine side */ 
+  int pipeDriverWriteSide;
+  /* Buffer to store the serial number, returned by dgtnixQueryString(DGTNIX_SERIAL_STRING) */
+  char serialBuffer[_DGTNIX_SIZE_SERIALNR+1];
+  /* Buffer to store the version of the board, returned by dgtnixQueryString(DGTNIX_VERSION_STRING) */
+  char versionBuffer[_DGTNIX_SIZE_VERSION+1];
+  /* Buffer to store the bus adress of the board, returned by dgtnixQueryString(DGTNIX_BUSADDRESS_STRING) */
+  char busadressBuffer[_DGTNIX_SIZE_BUSADDRESS+1];
+  /* Buffer to store the trademark of the board, returned by dgtnixQueryString(DGTNIX_TRADEMARK_STRING) */
+  char trademarkBuffer[257];
+  /* Flag to test wether the version string was already queryed to the board */
+  char versionFlag;
+  /* Flag to test wether the serial string was already queryed to the board */
+  char serialFlag;
+  /* Flag to test wether the trademark string was already queryed to the board */
+  char trademarkFlag;
+  /* Flag to test wether the busadress string was already queryed to the board */
+  char busadressFlag;
+  /* Flag for the verbose debug mode */
+  char debugMode;
+  /* Flag set to the real board or the virtual board */
+  char virtualBoardMode;
+  /* Used by dgtnixGetBoard(...), 
+     if the board has not changed it is not necessary to copy g_board to g_transmitedBoard */
+  char boardUpdated;
+  /* The time received from the DGT clock for white player (in seconds) */
+  int wtime;
+  /* The time received from the DGT clock for black player (in seconds) */
+  int btime;
+  /* Regarding the button pressed on the DGT clock, wether it is white turn's or not */
+  int wturn;
+  /* Control the orientation of the board, can be DGTNIX_BOARD_ORIENTATION_CLOCKLEFT or DGTNIX_BOARD_ORIENTATION_CLOCKRIGHT */
+  char boardOrientation;
+  /* simply ensure that the driver was initialised with dgtnixInit( ... ) */
+  char initialised;
+  /* This mutex is used by to ensure that during a dgtnixGetBoard(...) call, the board is'nt updated */
+  pthread_mutex_t mutex;
+  /* This mutex protects g_writeBuffer and the clock queue, filled by any thread */
+  pthread_mutex_t writeMutex;
+  /* Called after each message received from the board, see dgtnixSetEventCallback() */
+  dgtnixEventCallback eventCallback;
+  /* The last clock button pressed, see getClockButtonState() */
+  int clockButtonState;
+  /* Opaque pointer of the caller, see dgtnixSetUserData() */
+  void *userData;
+} _dgtnixBoard;
+
+#define _DGTNIX_BOARD_DEFAULTS { \
+  .epollDescriptor=-1, \
+  .wakeupPipe={-1,-1}, \
+  .descriptorDriverBoard=-1, \
+  .pipeEngineReadSide=-1, \
+  .pipeDriverWriteSide=-1, \
+  .debugMode=DGTNIX_DEBUG_OFF, \
+  .virtualBoardMode=_DGTNIX_REAL_BOARD, \
+  .boardOrientation=DGTNIX_BOARD_ORIENTATION_CLOCKLEFT, \
+  .mutex=PTHREAD_MUTEX_INITIALIZER, \
+  .writeMutex=PTHREAD_MUTEX_INITIALIZER }
+
+/* The board used until dgtnixNewBoard() is called, so that a single board
+   needs no setup */
+static _dgtnixBoard g_defaultBoard = _DGTNIX_BOARD_DEFAULTS;
+/* The board of the calling thread */
+static __thread _dgtnixBoard *g_current = &g_defaultBoard;
+
+#define g_board                 (g_current->board)
+#define g_transmitedBoard       (g_current->transmitedBoard)
+#define g_driverThread          (g_current->driverThread)
+#define g_readBuffer            (g_current->readBuffer)
+#define g_ringBuffer            (g_current->ringBuffer)
+#define g_ringHead              (g_current->ringHead)
+#define g_ringTail              (g_current->ringTail)
+#define g_writeBuffer           (g_current->writeBuffer)
+#define g_writeLength           (g_current->writeLength)
+#define g_clockQueue            (g_current->clockQueue)
+#define g_clockQueueCount       (g_current->clockQueueCount)
+#define g_clockMessage          (g_current->clockMessage)
+#define g_clockDuration         (g_current->clockDuration)
+#define g_clockMessageId        (g_current->clockMessageId)
+#define g_lastClockId           (g_current->lastClockId)
+#define g_clockAckPending       (g_current->clockAckPending)
+#define g_clockRetries          (g_current->clockRetries)
+#define g_clockSentTime         (g_current->clockSentTime)
+#define g_epollDescriptor       (g_current->epollDescriptor)
+#define g_wakeupPipe            (g_current->wakeupPipe)
+#define g_epollOut              (g_current->epollOut)
+#define g_driverRunning         (g_current->driverRunning)
+#define g_descriptorDriverBoard (g_current->descriptorDriverBoard)
+#define g_pipeEngineReadSide    (g_current->pipeEngineReadSide)
+#define g_pipeDriverWriteSide   (g_current->pipeDriverWriteSide)
+#define g_serialBuffer          (g_current->serialBuffer)
+#define g_versionBuffer         (g_current->versionBuffer)
+#define g_busadressBuffer       (g_current->busadressBuffer)
+#define g_trademarkBuffer       (g_current->trademarkBuffer)
+#define g_versionFlag           (g_current->versionFlag)
+#define g_serialFlag            (g_current->serialFlag)
+#define g_trademarkFlag         (g_current->trademarkFlag)
+#define g_busadressFlag         (g_current->busadressFlag)
+#define g_debugMode             (g_current->debugMode)
+#define g_virtualBoardMode      (g_current->virtualBoardMode)
+#define g_boardUpdated          (g_current->boardUpdated)
+#define g_wtime                 (g_current->wtime)
+#define g_btime                 (g_current->btime)
+#define g_wturn                 (g_current->wturn)
+#define g_boardOrientation      (g_current->boardOrientation)
+#define g_initialised           (g_current->initialised)
+#define g_mutex                 (g_current->mutex)
+#define g_writeMutex            (g_current->writeMutex)
+#define g_eventCallback         (g_current->eventCallback)
+#define clockButtonState        (g_current->clockButtonState)
+
 
 /**************************************/
 /* Intern function begins with _...   */
@@ -387,12 +519,158 @@ static void _sendMessageToBoard(int command)
 	  exit(-1);
 	}
     }
-  if(write(g_descriptorDriverBoard,&command ,1)!=1)
+  unsigned char c = command;
+  _queueWrite(&c, 1);
+}
+
+/*
+ * Append a command to the buffer of the commands to write to the board
+ * and wake up the driver thread, which does the actual write().
+ */
+static void _queueWrite(const unsigned char *message, size_t length)
+{
+  pthread_mutex_lock(&g_writeMutex);
+  if(g_writeLength + length > WRITEBUFFERSIZE)
     {
-      perror("dgtnix critical:sendMessageToBoard: write() error\n");
-      _closeDescriptor(&g_descriptorDriverBoard);
-      exit(-1);
+      pthread_mutex_unlock(&g_writeMutex);
+      perror("dgtnix critical:_queueWrite: write buffer overflow\n");
+      return;
     }
+  memcpy(g_writeBuffer + g_writeLength, message, length);
+  g_writeLength += length;
+  pthread_mutex_unlock(&g_writeMutex);
+  _wakeDriver();
+}
+
+static void _wakeDriver()
+{
+  char c = 0;
+  if(g_wakeupPipe[1] >= 0 && write(g_wakeupPipe[1], &c, 1) < 0 && errno != EAGAIN)
+    _debug("_wakeDriver: write() error\n");
+}
+
+/* Monotonic time in milliseconds */
+static long long _now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Remove the clock message at index i from the queue. The caller holds
+ * g_writeMutex.
+ */
+static void _removeClockEntry(int i)
+{
+  memmove(g_clockQueue + i, g_clockQueue + i + 1,
+	  (g_clockQueueCount - i - 1) * sizeof(_ClockEntry));
+  g_clockQueueCount--;
+}
+
+/*
+ * Index of the next clock message to display: the oldest one of the highest
+ * priority. The caller holds g_writeMutex and checks the queue is not empty.
+ */
+static int _nextClockEntry()
+{
+  int i, best = 0;
+
+  for(i = 1; i < g_clockQueueCount; i++)
+    if(g_clockQueue[i].priority > g_clockQueue[best].priority)
+      best = i;
+  return best;
+}
+
+/*
+ * Called by the driver thread only. Hand the next clock message to the writer
+ * once the previous one was acknowledged and displayed long enough, or send it
+ * again if its ACK did not come, then write as much as the board accepts
+ * without blocking. Return -1 on a write error.
+ */
+static int _flushWrites()
+{
+  long long now = _now();
+  int retval = 0;
+
+  pthread_mutex_lock(&g_writeMutex);
+  if(g_clockAckPending && now - g_clockSentTime >= _DGTNIX_CLOCK_ACK_TIMEOUT)
+    {
+      if(++g_clockRetries > _DGTNIX_CLOCK_MAX_RETRIES)
+	{
+	  _debug("no clock ACK received, message dropped\n");
+	  g_clockAckPending = 0;
+	}
+      else if(g_writeLength + _DGTNIX_SIZE_CLOCK_MESSAGE <= WRITEBUFFERSIZE)
+	{
+	  _debug("no clock ACK received, sending the message again\n");
+	  memcpy(g_writeBuffer + g_writeLength, g_clockMessage, _DGTNIX_SIZE_CLOCK_MESSAGE);
+	  g_writeLength += _DGTNIX_SIZE_CLOCK_MESSAGE;
+	  g_clockSentTime = now;
+	}
+    }
+  if(!g_clockAckPending && g_clockQueueCount
+     && now - g_clockSentTime >= g_clockDuration
+     && g_writeLength + _DGTNIX_SIZE_CLOCK_MESSAGE <= WRITEBUFFERSIZE)
+    {
+      int next = _nextClockEntry();
+      memcpy(g_clockMessage, g_clockQueue[next].message, _DGTNIX_SIZE_CLOCK_MESSAGE);
+      g_clockDuration = g_clockQueue[next].duration;
+      g_clockMessageId = g_clockQueue[next].id;
+      _removeClockEntry(next);
+      memcpy(g_writeBuffer + g_writeLength, g_clockMessage, _DGTNIX_SIZE_CLOCK_MESSAGE);
+      g_writeLength += _DGTNIX_SIZE_CLOCK_MESSAGE;
+      g_clockAckPending = 1;
+      g_clockRetries = 0;
+      g_clockSentTime = now;
+    }
+  while(g_writeLength > 0)
+    {
+      ssize_t n = write(g_descriptorDriverBoard, g_writeBuffer, g_writeLength);
+      if(n < 0)
+	{
+	  if(errno == EINTR)
+	    continue;
+	  if(errno != EAGAIN)
+	    {
+	      dgtnix_errno = errno;
+	      perror("dgtnix critical:_flushWrites: write() error\n");
+	      retval = -1;
+	    }
+	  break;
+	}
+      memmove(g_writeBuffer, g_writeBuffer + n, g_writeLength - n);
+      g_writeLength -= n;
+    }
+  /* Watch for EPOLLOUT only while the board does not accept all our writes */
+  if((g_writeLength > 0) != g_epollOut)
+    {
+      struct epoll_event ev;
+      g_epollOut = (g_writeLength > 0);
+      ev.events = EPOLLIN | (g_epollOut ? EPOLLOUT : 0);
+      ev.data.fd = g_descriptorDriverBoard;
+      epoll_ctl(g_epollDescriptor, EPOLL_CTL_MOD, g_descriptorDriverBoard, &ev);
+    }
+  pthread_mutex_unlock(&g_writeMutex);
+  return retval;
+}
+
+/*
+ * Time in milliseconds before the driver thread must call _flushWrites()
+ * again for the clock queue, or -1 if nothing is waiting.
+ */
+static int _clockTimeout()
+{
+  long long timeout = -1;
+  long long elapsed = _now() - g_clockSentTime;
+
+  pthread_mutex_lock(&g_writeMutex);
+  if(g_clockAckPending)
+    timeout = _DGTNIX_CLOCK_ACK_TIMEOUT - elapsed;
+  else if(g_clockQueueCount)
+    timeout = g_clockDuration - elapsed;
+  pthread_mutex_unlock(&g_writeMutex);
+  return timeout < 0 && timeout != -1 ? 0 : (int) timeout;
 }
 
 
@@ -424,13 +702,11 @@ static void _sendMessageToBoard(int command)
 */
 
 /*
- * Wrapper of the unix write(...) that sends a 
- * message to the DGT board.
+ * Queue a message for the clock display, see dgtnixScheduleMessageOnClock().
+ * The message is written to the board by the driver thread.
  */
-void _sendMessageToClock(unsigned char a, unsigned char b, unsigned char c, unsigned char d, unsigned char e, unsigned char f, unsigned char beep, unsigned char dots)
+int _sendMessageToClock(unsigned char a, unsigned char b, unsigned char c, unsigned char d, unsigned char e, unsigned char f, unsigned char beep, unsigned char dots, int priority, int duration)
 {
-  pthread_mutex_lock (&clock_ack_mutex);
-
   if(!(g_debugMode == DGTNIX_DEBUG_OFF))
     {
       _debug("Sending message to clock\n"); 
@@ -440,7 +716,34 @@ void _sendMessageToClock(unsigned char a, unsigned char b, unsigned char c, unsi
 	  exit(-1);
 	}
     }
-  unsigned char message[13];
+  unsigned char *message;
+  int i, lowest, id;
+  pthread_mutex_lock(&g_writeMutex);
+  /* Informative messages are refreshed all the time, only the last one is worth displaying */
+  if(priority == DGTNIX_DISPLAY_INFO)
+    for(i = g_clockQueueCount - 1; i >= 0; i--)
+      if(g_clockQueue[i].priority == DGTNIX_DISPLAY_INFO)
+	_removeClockEntry(i);
+  /* The display of stale messages is useless, drop the oldest of the lowest priority */
+  if(g_clockQueueCount == _DGTNIX_CLOCK_QUEUE_SIZE)
+    {
+      lowest = 0;
+      for(i = 1; i < g_clockQueueCount; i++)
+	if(g_clockQueue[i].priority < g_clockQueue[lowest].priority)
+	  lowest = i;
+      if(g_clockQueue[lowest].priority > priority)
+	{
+	  _debug("clock queue full, message dropped\n");
+	  pthread_mutex_unlock(&g_writeMutex);
+	  return 0;
+	}
+      _debug("clock queue full, oldest message dropped\n");
+      _removeClockEntry(lowest);
+    }
+  g_clockQueue[g_clockQueueCount].priority = priority;
+  g_clockQueue[g_clockQueueCount].duration = duration;
+  g_clockQueue[g_clockQueueCount].id = id = ++g_lastClockId;
+  message = g_clockQueue[g_clockQueueCount++].message;
   message[0]=_DGTNIX_CLOCK_MESSAGE;
   message[1]=0x0b;
   message[2]=0x03;
@@ -454,32 +757,9 @@ void _sendMessageToClock(unsigned char a, unsigned char b, unsigned char c, unsi
   message[10]=dots;
   message[11]=beep?0x03:0x01;
   message[12]=0x00;
-  int numRetries = 0;
-  retry:
-  if(write(g_descriptorDriverBoard,&message ,13)!=13)
-    {
-      perror("dgtnix critical:sendMessageToClock: write() error. Retrying.. \n");
-      ++ numRetries;
-      if (numRetries>5) {
-        perror("dgtnix critical:sendMessageToClock: More than 5 retries, exiting.\n");
-        _closeDescriptor(&g_descriptorDriverBoard);
-        exit(-1);
-      }
-      sleep(numRetries*2);
-      goto retry;
-    }
-
-    sleep(1); //wait for the ACK message
-    if(pthread_mutex_trylock(&clock_ack_mutex))
-    {
-        //printf("WE ARE STUCK! - NO ACK RECEIVED\n");
-        goto retry;
-    }
-    else
-    {
-        //printf("YEPEEE  ACK RECEIVED\n");
-        pthread_mutex_unlock(&clock_ack_mutex);
-    }
+  pthread_mutex_unlock(&g_writeMutex);
+  _wakeDriver();
+  return id;
 }
 
 void dgtnixUpdate()
@@ -533,13 +813,19 @@ unsigned char _characterToLcdCode(char c)
 
 /* Prints a 6 character string message on the DGT Clock */
 void dgtnixPrintMessageOnClock(const char * message, unsigned char beep, unsigned char dots)
+{
+  dgtnixScheduleMessageOnClock(message, beep, dots, DGTNIX_DISPLAY_NORMAL, DGTNIX_DISPLAY_DURATION);
+}
+
+/* Queues a 6 character string message for the DGT Clock */
+int dgtnixScheduleMessageOnClock(const char * message, unsigned char beep, unsigned char dots, int priority, int duration)
 {
     unsigned char a,b,c,d,e,f; 
     printf("Sending message:%s\n",message);
     if(strlen(message)<6) 
     {
         perror("dgtnix critical:dgtnixPrintMessageOnClock: invalid message length\n");
-        return;
+        return 0;
     }   
     a=_characterToLcdCode(message[0]);
     b=_characterToLcdCode(message[1]);
@@ -548,9 +834,19 @@ void dgtnixPrintMessageOnClock(const char * message, unsigned char beep, unsigne
     e=_characterToLcdCode(message[4]);
     f=_characterToLcdCode(message[5]); 
     
-    pthread_mutex_lock (&clock_send_mutex);
-    _sendMessageToClock(a,b,c,d,e,f,beep,dots);
-    pthread_mutex_unlock (&clock_send_mutex);
+    return _sendMessageToClock(a,b,c,d,e,f,beep,dots,priority,duration);
+}
+
+/* Drops the clock messages of the given priority and below not displayed yet */
+void dgtnixCancelMessagesOnClock(int priority)
+{
+  int i;
+
+  pthread_mutex_lock(&g_writeMutex);
+  for(i = g_clockQueueCount - 1; i >= 0; i--)
+    if(g_clockQueue[i].priority <= priority)
+      _removeClockEntry(i);
+  pthread_mutex_unlock(&g_writeMutex);
 }
 
 /*
@@ -566,46 +862,95 @@ static void _sendMessageToEngine(const char*message, size_t length)
     }
   if(write(g_pipeDriverWriteSide,(void *) message, length) != length)
     {
+      /* The pipe is non blocking: if the engine does not read it, drop the
+	 message rather than stop reading the board */
+      if(errno == EAGAIN)
+	return;
       perror("dgtnix critical:sendMessageToEngine: write error\n");
       exit(-1);
     }
 }
 
 /*
- * The main polling loop of the thread, 
- * waits for events on the ports. 
- * When they appear, call _readMessageFromBoard().
+ * Forward the message identified by commandID to the registered 
+ * event callback, if any.
+ */
+static void _notifyEngine(int commandID)
+{
+  if(g_eventCallback == NULL)
+    return;
+  switch(commandID)
+    {
+    case _DGTNIX_BOARD_DUMP:
+    case _DGTNIX_FIELD_UPDATE:
+      g_eventCallback(DGTNIX_EVENT_BOARD, 0);
+      break;
+    case _DGTNIX_BWTIME:
+      if(clockButtonState)
+	g_eventCallback(DGTNIX_EVENT_BUTTON, getClockButtonState());
+      else
+	g_eventCallback(DGTNIX_EVENT_CLOCK, 0);
+      break;
+    default:
+      break;
+    }
+}
+
+/*
+ * The main polling loop of the thread, waits with epoll for chars to read
+ * on the board, for commands to write, or for the next clock deadline.
+ * Chars read are framed into messages by _readMessageFromBoard(), which is
+ * called until no complete message is left in the ring buffer.
  */
 static void *_threadManagedFunc(void *params)
 { 
+  g_current = (_dgtnixBoard *)params;
   g_initialised = 1;
   _queryVendorStrings();
-  sem_init(&dgtnixEventSemaphore,0,0);
   _sendMessageToBoard(_DGTNIX_SEND_UPDATE);
-  int numRetries = 0;
-  while( 1 ) 
+  int commandID;
+  struct epoll_event events[2];
+  while( g_driverRunning ) 
     {  
-      if(_readMessageFromBoard()<0)
+      if(_flushWrites() < 0)
+	break;
+      int n = epoll_wait(g_epollDescriptor, events, 2, _clockTimeout());
+      if(n < 0)
 	{
-	  ++numRetries;
-	  sleep(numRetries*2);
-	  fprintf(stderr, "dgtnixManagerFunc:read error -- retrying\n");
-	  if (numRetries>5)
+	  if(errno == EINTR)
+	    continue;
+	  dgtnix_errno = errno;
+	  fprintf(stderr, "dgtnixManagerFunc:epoll_wait error, terminating\n");
+	  break;
+	}
+      int i, status = 0;
+      for(i = 0; i < n; i++)
+	{
+	  if(events[i].data.fd == g_wakeupPipe[0])
 	    {
-	      fprintf(stderr,"dgtnixManagerFunc:read error after five retries, terminating\n");
-	      break;
+	      char drain[64];
+	      while(read(g_wakeupPipe[0], drain, sizeof(drain)) > 0);
+	      continue;
 	    }
-	  continue;
+	  do
+	    {
+	      status = _fillRingBuffer();
+	      while((commandID = _readMessageFromBoard()) >= 0)
+		/*_dumpBoard(g_board);*/
+		_notifyEngine(commandID);
+	    }
+	  while(status > 0);
+	}
+      if(status < 0)
+	{
+	  fprintf(stderr,"dgtnixManagerFunc:read error, terminating\n");
+	  break;
 	}
-      else
-        {
-          numRetries = 0;
-        }
-      /*_dumpBoard(g_board);*/
-      sem_post(&dgtnixEventSemaphore); 
     }
-  _closeAllDescriptors();
-  g_initialised = 0;
+  /* The board is gone: the descriptors are left to dgtnixClose(), and the last
+     board stays readable until then */
+  if(g_driverRunning && g_eventCallback != NULL)
+    g_eventCallback(DGTNIX_EVENT_CLOSED, 0);
   return params;
 }
 
@@ -726,7 +1071,9 @@ static void _bwtimeReceived(unsigned char buffer[7])
     processClockBits(buffer[6]);
      //clock ack message
     _debug("clock ACK received\n");
-    pthread_mutex_unlock (&clock_ack_mutex);
+    if(g_clockAckPending && g_eventCallback != NULL)
+      g_eventCallback(DGTNIX_EVENT_DISPLAYED, g_clockMessageId);
+    g_clockAckPending = 0;
     return;
   }
     
@@ -858,95 +1205,89 @@ static void _fieldUpdateReceived(int mposition, char mpiece)
 
 
 /*
- * The main read function, called by the _threadManagerFunction when there are chars to be read
- * identify the message on the port, update the intern board representation and reemit a message 
- * to the engine.
+ * Read all the chars available on the board descriptor into the ring buffer,
+ * without blocking. Return 1 if the ring buffer is full and more chars may be
+ * waiting, 0 when everything was read, -1 on error or end of file.
  */
-static int _readMessageFromBoard()
+static int _fillRingBuffer()
 {
   if(g_descriptorDriverBoard<0)
     {
-      _debug("read(g_descriptorDriverBoard, header, 1) 0 :int readMessageFromBoard(int g_descriptorDriverBoard):invalid descriptor\n");
+      _debug("_fillRingBuffer():invalid descriptor\n");
       return -1;
     }
-  int  j = 0;
-  unsigned char header[3];
-  int charRead;
-  unsigned int commandID;
-  int messageLength=0.;
-  int i=0;
-  
-  /* Clean the buffer */
-  for(i=0; i < READBUFFERSIZE; i++)
-    g_readBuffer[i] = -10;
-  
-  /* first character, MESSAGE ID one byte, MSB (MESSAGE BIT) always 1 */
-  if( (charRead = read(g_descriptorDriverBoard, header, 1) ) < 0)
-    {
-      dgtnix_errno = errno;
-      _debug("read(g_descriptorDriverBoard, header, 1) -1- int readMessageFromBoard(int g_descriptorDriverBoard)\n");
-      return -1;
-    }
-  if( !(header[0] & 128) )
+  while(g_ringTail - g_ringHead < RINGBUFFERSIZE)
     {
-      /* Invalid character */
-      _debug("invalid message -2- int readMessageFromBoard(int g_descriptorDriverBoard) :%c %d\n", header[0], header[0]);
-      return -1;
-    }
-  commandID = header[0] & 127;
-  
-  /* Second character, MSB of MESSAGE SIZE one byte, 
-     MSB always 0, carrying D13 to D7 of the  total message length, 
-     including the 3 header byte */
-  if( (charRead = read(g_descriptorDriverBoard, &header[1], 1) ) < 0)
-    {
-      dgtnix_errno = errno;
-      _debug("read(g_descriptorDriverBoard, header, 1) -3- int readMessageFromBoard(int g_descriptorDriverBoard)\n");
-      return -1;
-    }
-  if( header[1] & 128 )
-    {
-      _debug("invalid message -4- int readMessageFromBoard(int g_descriptorDriverBoard) :%c\n", header[1]);
-      return -1;
-    }
-  
-  /* Third character, LSB of MESSAGE SIZE one byte, 
-     MSB always 0, carrying  D6 to D0 of the total message length, 
-     including the 3 header charRead */
-  if( (charRead = read(g_descriptorDriverBoard, &header[2], 1) ) < 0)
-    {
-      dgtnix_errno = errno;
-      _debug("read(g_descriptorDriverBoard, header, 1) -5- int readMessageFromBoard(int g_descriptorDriverBoard)\n");
-      return -1;
-    }
-  if( header[2] & 128 )
-    {
-      _debug("invalid message -6- int readMessageFromBoard(int g_descriptorDriverBoard) :%c %d\n", header[2], header[2]);
-      return -1;
+      size_t start = g_ringTail & (RINGBUFFERSIZE - 1);
+      size_t room = RINGBUFFERSIZE - (g_ringTail - g_ringHead);
+      if(room > RINGBUFFERSIZE - start)
+	room = RINGBUFFERSIZE - start;
+      ssize_t charRead = read(g_descriptorDriverBoard, g_ringBuffer + start, room);
+      if(charRead < 0)
+	{
+	  if(errno == EINTR)
+	    continue;
+	  if(errno == EAGAIN)
+	    return 0;
+	  dgtnix_errno = errno;
+	  _debug("read(g_descriptorDriverBoard, ...) error in _fillRingBuffer()\n");
+	  return -1;
+	}
+      if(charRead == 0)
+	{
+	  _debug("end of file on the board descriptor in _fillRingBuffer()\n");
+	  return -1;
+	}
+      g_ringTail += charRead;
     }
+  return 1;
+}
+
+#define _RING_AT(i) g_ringBuffer[(g_ringHead + (i)) & (RINGBUFFERSIZE - 1)]
+
+/*
+ * The main read function, called by the _threadManagerFunction when there are chars 
+ * in the ring buffer. Extract the next complete message, update the intern board
+ * representation and reemit a message to the engine.
+ * Invalid chars are skipped until a valid header is found.
+ * Return the ID of the message read, or -1 if no complete message is buffered.
+ */
+static int _readMessageFromBoard()
+{
+  int  j = 0;
+  unsigned int commandID;
+  int messageLength;
   
-  messageLength=(header[1] << 7) + header[2];
-  messageLength-=3;
-  /* Usefull debug stuff */  
-  /*
-  printf("longueur:%d\nheader[1]:%d\nheader[1]<<7:%d\nheader[2]:%d\n"
-	 ,messageLength
-	 ,header[1]
-	 ,header[1] << 7
-	 ,header[2]);
-  */
-  int tmp1=0; 
-  int tmp2;
-  while(tmp1 < messageLength)
+  while(1)
     {
-      if((tmp2 = read(g_descriptorDriverBoard, g_readBuffer + tmp1, messageLength-tmp1 ) )< 0 ) 
+      if(g_ringTail - g_ringHead < 3)
+	return -1;
+      /* first character, MESSAGE ID one byte, MSB (MESSAGE BIT) always 1 
+	 Second and third characters, MESSAGE SIZE, MSB always 0, carrying D13 to D7 
+	 then D6 to D0 of the total message length, including the 3 header bytes */
+      if( !(_RING_AT(0) & 128) || (_RING_AT(1) & 128) || (_RING_AT(2) & 128) )
 	{
-	  dgtnix_errno=errno;
-	  _debug("read(g_descriptorDriverBoard, buffer + tmp, messageLength ) -7- int readMessageFromBoard(int g_descriptorDriverBoard)\n");
-	  return -1;
+	  _debug("invalid message header in readMessageFromBoard(): %d, skipped\n", _RING_AT(0));
+	  g_ringHead++;
+	  continue;
 	}
-      tmp1 += tmp2; 
+      messageLength = (_RING_AT(1) << 7) + _RING_AT(2) - 3;
+      if(messageLength < 0 || messageLength > READBUFFERSIZE)
+	{
+	  _debug("invalid message length in readMessageFromBoard(): %d, skipped\n", messageLength);
+	  g_ringHead++;
+	  continue;
+	}
+      break;
     }
+  if(g_ringTail - g_ringHead < (size_t)messageLength + 3)
+    return -1;
+
+  commandID = _RING_AT(0) & 127;
+  for(j = 0; j < messageLength; j++)
+    g_readBuffer[j] = _RING_AT(3 + j);
+  g_ringHead += messageLength + 3;
+
   switch (commandID) 
     {
     case _DGTNIX_NONE:
@@ -1009,13 +1350,10 @@ static int _readMessageFromBoard()
       _debug("version %2d.%02d\n", g_readBuffer[0], g_readBuffer[1]);
       break;
     default:
-      {
-	perror("dgtnix critical: unknown response from the board\n");
-	fprintf(stderr,"unknown response: (%x)\n", commandID);
-	exit(-1);
-      }
+      _debug("unknown response from the board: (%x), skipped\n", commandID);
+      break;
     }
-  return 1;
+  return commandID;
 }
 
 /**
@@ -1139,6 +1477,13 @@ static int _closeAllDescriptors()
       _debug("close g_descriptorDriverBoard - int dgtnixWriteCOMPort (int port)\n");
       retval = -1;
     }
+  /* clear the epoll instance and the wakeup pipe of the driver thread */
+  if(g_epollDescriptor >= 0)
+    _closeDescriptor(&g_epollDescriptor);
+  if(g_wakeupPipe[0] >= 0)
+    _closeDescriptor(&g_wakeupPipe[0]);
+  if(g_wakeupPipe[1] >= 0)
+    _closeDescriptor(&g_wakeupPipe[1]);
   return retval;
 }
 
@@ -1190,6 +1535,49 @@ static void _setBoardOrientation(unsigned int orientation)
 /* they begin with dgtnix...                                                     */
 /*********************************************************************************/
 
+void dgtnixSetEventCallback(dgtnixEventCallback callback)
+{
+  g_eventCallback = callback;
+}
+
+void *dgtnixNewBoard(void)
+{
+  static const _dgtnixBoard defaults = _DGTNIX_BOARD_DEFAULTS;
+  _dgtnixBoard *board = malloc(sizeof(_dgtnixBoard));
+  if(board == NULL)
+    {
+      dgtnix_errno = errno;
+      return NULL;
+    }
+  *board = defaults;
+  g_current = board;
+  return board;
+}
+
+void dgtnixSelectBoard(void *board)
+{
+  g_current = board != NULL ? (_dgtnixBoard *)board : &g_defaultBoard;
+}
+
+void dgtnixDeleteBoard(void *board)
+{
+  if(board == NULL || board == &g_defaultBoard)
+    return;
+  if(g_current == board)
+    g_current = &g_defaultBoard;
+  free(board);
+}
+
+void dgtnixSetUserData(void *data)
+{
+  g_current->userData = data;
+}
+
+void *dgtnixGetUserData(void)
+{
+  return g_current->userData;
+}
+
 void dgtnixSetOption(unsigned long option, unsigned int value)
 {
   switch(option)
@@ -1239,9 +1627,9 @@ int dgtnixClose()
   _assertDriverInitialised("dgtnixClose");
   void *status;
   int rc;
-  /* Kill Previous thread if exists */
-  if(pthread_cancel(g_driverThread) == ESRCH)
-    _debug("dgtnixClose() can not close the driver thread (no such thread)");
+  /* Stop the driver thread, it leaves epoll_wait() when woken up */
+  g_driverRunning = 0;
+  _wakeDriver();
   rc = pthread_join(g_driverThread, &status);
   if (rc) 
     _debug("dgtnixClose() return code from pthread_join() is %d\n", rc);
@@ -1278,7 +1666,41 @@ int dgtnixInit(const char *port)
       if( _setUnixSocket(port) < 0)
 	return -1;
     }
-  
+
+  int retval = _startDriver(port);
+  if(retval == -2)
+    {
+      /* The answer of the device is incorrect, try again */
+      dgtnixClose();
+      sleep(3);
+      return dgtnixInit(port);
+    }
+  return retval;
+}
+
+int dgtnixInitDescriptor(int descriptor)
+{
+  if(g_initialised != 0)
+    _debug("Close driver first\n");
+  _debug("opening driver on descriptor %d\n", descriptor);
+  g_virtualBoardMode = _DGTNIX_VIRTUAL_BOARD;
+  g_descriptorDriverBoard = descriptor;
+
+  int retval = _startDriver("descriptor");
+  if(retval == -2)
+    dgtnixClose();
+  return retval;
+}
+
+/*
+ * Start the driver thread on the opened g_descriptorDriverBoard and wait for
+ * the board to answer. Return the engine side of the driver pipe, -1 on error
+ * or -2 if the board does not answer.
+ */
+static int _startDriver(const char *port)
+{
+  int i;
+
   /* do some initialisation stuff 
    *
    * ...
@@ -1300,6 +1722,33 @@ int dgtnixInit(const char *port)
   g_btime=-1;
   g_wtime=-1;
   g_wturn=-1;
+  g_ringHead=g_ringTail=0;
+  g_writeLength=0;
+  g_clockQueueCount=0;
+  g_clockDuration=0;
+  g_clockMessageId=0;
+  g_clockAckPending=0;
+  g_clockSentTime=0;
+  g_epollOut=0;
+
+  /* All the I/O on the board is non blocking and driven by epoll in the driver thread.
+   * Other threads queue their writes and wake it up with g_wakeupPipe.
+   */
+  struct epoll_event ev;
+  fcntl(g_descriptorDriverBoard, F_SETFL, fcntl(g_descriptorDriverBoard, F_GETFL) | O_NONBLOCK);
+  if(pipe(g_wakeupPipe)<0 || (g_epollDescriptor = epoll_create(2))<0)
+    {
+      dgtnix_errno = errno;
+      _debug("epoll:void dgtnixInit(const char *port)\n");
+      return -1;
+    }
+  fcntl(g_wakeupPipe[0], F_SETFL, O_NONBLOCK);
+  fcntl(g_wakeupPipe[1], F_SETFL, O_NONBLOCK);
+  ev.events = EPOLLIN;
+  ev.data.fd = g_descriptorDriverBoard;
+  epoll_ctl(g_epollDescriptor, EPOLL_CTL_ADD, g_descriptorDriverBoard, &ev);
+  ev.data.fd = g_wakeupPipe[0];
+  epoll_ctl(g_epollDescriptor, EPOLL_CTL_ADD, g_wakeupPipe[0], &ev);
   
   /* 
    * do a reset of the 'presumed' board
@@ -1322,9 +1771,11 @@ int dgtnixInit(const char *port)
     }
   g_pipeEngineReadSide = sv[0];
   g_pipeDriverWriteSide = sv[1];
+  fcntl(g_pipeDriverWriteSide, F_SETFL, O_NONBLOCK);
   
   /* Start processing events on the port */
-  if(pthread_create( &g_driverThread, NULL,_threadManagedFunc, NULL) != 0)
+  g_driverRunning = 1;
+  if(pthread_create( &g_driverThread, NULL,_threadManagedFunc, g_current) != 0)
     {
       /* keep msg to client app */
       _debug("pthread_create:void dgtnixInit(const char *port)\n");
@@ -1341,10 +1792,7 @@ int dgtnixInit(const char *port)
     /* The answer of the device is incorrect, it's not a dgt board */
     {
       _debug("%s does not respond to the init query.\n" ,port);
-      dgtnixClose();
-      sleep(3);
-      return dgtnixInit(port);
-      //return -2;
+      return -2;
     }
   _debug("Board initialised\n");
   return g_pipeEngineReadSide;
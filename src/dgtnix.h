@@ -81,6 +81,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 /******************************/
 /*
   int dgtnixInit(const char *);
+  int dgtnixInitDescriptor(int);
   int dgtnixClose();
   const char *dgtnixGetBoard();
   const char *dgtnixToPrintableBoard(const char *);
@@ -93,7 +94,6 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #ifndef __DGTNIX_H
 #define __DGTNIX_H
 
-#include <semaphore.h>
 #include <stdbool.h>
 
 #ifdef __cplusplus
@@ -146,6 +146,13 @@ extern "C" {
 #define DGTNIX_LEFT_DOT 0x08
 #define DGTNIX_LEFT_SEMICOLON 0x10
 #define DGTNIX_LEFT_1 0x20
+
+/* Priorities of the clock messages, see dgtnixScheduleMessageOnClock() */
+#define DGTNIX_DISPLAY_INFO 0
+#define DGTNIX_DISPLAY_NORMAL 1
+#define DGTNIX_DISPLAY_URGENT 2
+/* Default time a clock message stays displayed (ms) */
+#define DGTNIX_DISPLAY_DURATION 1000
   
   /******************************/
   /* API Functions declarations */
@@ -173,6 +180,13 @@ extern "C" {
    * + a positive number if success, this number is the descriptor of the read-only file on which the communications with the board will occur.
    */
   int dgtnixInit(const char *);
+
+  /* int dgtnixInitDescriptor(int descriptor);
+   * Same as dgtnixInit() on an already connected stream descriptor that speaks
+   * the virtual board protocol, as one end of a socketpair. The descriptor is
+   * closed by dgtnixClose().
+   */
+  int dgtnixInitDescriptor(int);
   
   /* int dgtnixClose();
    * Simpy kill running thread and opened descriptors if any.
@@ -291,16 +305,83 @@ extern "C" {
   
   const char *dgtnixToPrintableBoard(const char *);
   
-  /* Prints a 6 character string message on the DGT Clock */
+  /* Prints a 6 character string message on the DGT Clock, with the
+   * DGTNIX_DISPLAY_NORMAL priority for DGTNIX_DISPLAY_DURATION ms */
   void dgtnixPrintMessageOnClock(const char *, unsigned char beep, unsigned char dots);
+
+  /* int dgtnixScheduleMessageOnClock(const char *message, unsigned char beep, unsigned char dots, int priority, int duration);
+   * Queues a 6 character string message for the DGT Clock and returns at once.
+   * The driver thread displays the waiting messages one at a time, highest
+   * priority first and in order within a priority, each one once the previous
+   * one has been displayed for its duration. Only the last waiting
+   * DGTNIX_DISPLAY_INFO message is kept.
+   *
+   * Parameters :
+   * + priority : DGTNIX_DISPLAY_INFO, DGTNIX_DISPLAY_NORMAL or DGTNIX_DISPLAY_URGENT
+   * + duration : minimum time the message stays displayed, in milliseconds
+   *
+   * Return : an identifier of the message, reported with DGTNIX_EVENT_DISPLAYED
+   * when the clock acknowledges it, or 0 if the message was dropped
+   */
+  int dgtnixScheduleMessageOnClock(const char *, unsigned char beep, unsigned char dots, int priority, int duration);
+
+  /* void dgtnixCancelMessagesOnClock(int priority);
+   * Drops the waiting clock messages of the given priority and below. The
+   * message on display is left alone.
+   */
+  void dgtnixCancelMessagesOnClock(int);
   void dgtnixUpdate();
 
   /* Manage clock buttons */
   int getClockButtonState();
-  extern int clockButtonState;
-  
-  /* Event semaphore */
-  extern sem_t dgtnixEventSemaphore;
+
+  /* Events reported through the callback set with dgtnixSetEventCallback() */
+#define DGTNIX_EVENT_BOARD 0x01
+#define DGTNIX_EVENT_BUTTON 0x02
+#define DGTNIX_EVENT_CLOCK 0x03
+#define DGTNIX_EVENT_DISPLAYED 0x04
+#define DGTNIX_EVENT_CLOSED 0x05
+
+  /* void dgtnixSetEventCallback(dgtnixEventCallback callback);
+   * Register the function called by the driver thread after each message
+   * received from the board. The first parameter is one of the
+   * DGTNIX_EVENT_... codes, the second one is the clock button that was
+   * pressed for DGTNIX_EVENT_BUTTON, the identifier of the clock message
+   * acknowledged for DGTNIX_EVENT_DISPLAYED and 0 otherwise.
+   * DGTNIX_EVENT_CLOSED is sent once when the driver thread stops because the
+   * board is gone, dgtnixClose() must still be called.
+   * The callback runs on the driver thread and must not block.
+   */
+  typedef void (*dgtnixEventCallback)(int, int);
+  void dgtnixSetEventCallback(dgtnixEventCallback);
+
+  /* Several boards can be driven at once. The dgtnix... functions work on the
+   * current board of the calling thread, which is a default board until
+   * another one is selected, so that a program with a single board needs
+   * none of the functions below. The event callback runs on the driver thread
+   * of its board, with that board current.
+   *
+   * void *dgtnixNewBoard(void);
+   * Allocates a new board, not initialised yet, and makes it the current
+   * board of the calling thread. Return : the board, or NULL on error.
+   *
+   * void dgtnixSelectBoard(void *board);
+   * Makes board the current board of the calling thread, NULL selects the
+   * default board.
+   *
+   * void dgtnixDeleteBoard(void *board);
+   * Frees a board returned by dgtnixNewBoard(), dgtnixClose() must have been
+   * called on it first.
+   *
+   * void dgtnixSetUserData(void *data); void *dgtnixGetUserData(void);
+   * Attach an opaque pointer to the current board, typically for the event
+   * callback to find its caller.
+   */
+  void *dgtnixNewBoard(void);
+  void dgtnixSelectBoard(void *);
+  void dgtnixDeleteBoard(void *);
+  void dgtnixSetUserData(void *);
+  void *dgtnixGetUserData(void);
   
 #ifdef __cplusplus
 }
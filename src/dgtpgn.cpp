@@ -0,0 +1,215 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2012 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2012 Jean-Francois Romang
+  Copyright (C) 2012-2013 Shivkumar Shivaji
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "dgtpgn.h"
+
+using std::string;
+
+namespace {
+
+  // Time during which the text sent to the writer is collected before being
+  // written in a single batch, in milliseconds.
+  const int BatchTime = 2000;
+
+  // write_file() writes the text to a file opened with the given fopen() mode
+  // and returns once it is on the disk, so that a power loss cannot lose it.
+  bool write_file(const string& name, const char* mode, const string& text) {
+
+    FILE* f = std::fopen(name.c_str(), mode);
+
+    if (!f)
+        return false;
+
+    bool ok =   std::fwrite(text.data(), 1, text.size(), f) == text.size()
+             && !std::fflush(f)
+             && !fsync(fileno(f));
+
+    return !std::fclose(f) && ok;
+  }
+
+  // sync_dir() syncs the directory of a file, so that a rename() to this file
+  // is on the disk too.
+  void sync_dir(const string& name) {
+
+    size_t slash = name.rfind('/');
+    string dir = slash == string::npos ? "." : slash ? name.substr(0, slash) : "/";
+    int fd = ::open(dir.c_str(), O_RDONLY);
+
+    if (fd >= 0)
+    {
+        fsync(fd);
+        close(fd);
+    }
+  }
+}
+
+namespace DGT {
+
+/// PgnWriter::open() starts a new PGN file, truncating any previous one
+
+void PgnWriter::open(const string& name) {
+
+  mutex.lock();
+  fileName = name;
+  archive.clear();
+  current.clear();
+  pending.clear();
+  nextPly.clear();
+  plies.clear();
+  regenerate = true;
+  mutex.unlock();
+
+  sync();
+}
+
+
+/// PgnWriter::append() adds some text, as a comment, to the current game. It
+/// belongs to the ply of the next move, added with append_move(). new_game()
+/// ends the current game, if any. All of them only queue a write.
+
+void PgnWriter::append(const string& text) {
+
+  mutex.lock();
+  current += text;
+  pending += text;
+  nextPly += text;
+  sleepCondition.notify_one();
+  mutex.unlock();
+}
+
+void PgnWriter::append_move(const string& text) {
+
+  mutex.lock();
+  current += text;
+  pending += text;
+  plies.push_back(nextPly + text);
+  nextPly.clear();
+  sleepCondition.notify_one();
+  mutex.unlock();
+}
+
+void PgnWriter::new_game() {
+
+  mutex.lock();
+  if (!current.empty())
+  {
+      archive += current + "\n";
+      pending += "\n";
+      current.clear();
+      nextPly.clear();
+      plies.clear();
+      sleepCondition.notify_one();
+  }
+  mutex.unlock();
+}
+
+
+/// PgnWriter::take_back() keeps the first 'ply' plies of the current game, with
+/// their comments. The file is regenerated at the next batch.
+
+void PgnWriter::take_back(size_t ply) {
+
+  mutex.lock();
+  if (ply < plies.size())
+      plies.resize(ply);
+  current.clear();
+  for (size_t i = 0; i < plies.size(); ++i)
+      current += plies[i];
+  nextPly.clear();
+  pending.clear();
+  regenerate = true;
+  sleepCondition.notify_one();
+  mutex.unlock();
+}
+
+
+/// PgnWriter::sync() writes what is queued at once, from the calling thread,
+/// as before the program exits. It returns once the file is on the disk.
+
+void PgnWriter::sync() {
+
+  write_pending();
+}
+
+
+/// PgnWriter::write_pending() takes the queued text under the lock and does the
+/// file I/O without it, so that the DGT loop can keep queueing meanwhile.
+
+void PgnWriter::write_pending() {
+
+  fileMutex.lock();
+
+  mutex.lock();
+  bool full = regenerate;
+  string text = full ? archive + current : pending;
+  string name = fileName;
+  pending.clear();
+  regenerate = false;
+  mutex.unlock();
+
+  if (full)
+  {
+      // The temporary file must be on the disk before it replaces the old one
+      string tmpName = name + ".tmp";
+
+      if (!write_file(tmpName, "w", text) || std::rename(tmpName.c_str(), name.c_str()))
+          std::perror("PgnWriter: cannot regenerate the PGN file");
+      else
+          sync_dir(name);
+  }
+  else if (!text.empty() && !write_file(name, "a", text))
+      std::perror("PgnWriter: cannot append to the PGN file");
+
+  fileMutex.unlock();
+}
+
+
+/// PgnWriter::idle_loop() waits for some text to write, lets the writes of the
+/// next BatchTime milliseconds join it and writes them all at once.
+
+void PgnWriter::idle_loop() {
+
+  while (!exit)
+  {
+      mutex.lock();
+
+      while (!exit && pending.empty() && !regenerate)
+          sleepCondition.wait(mutex);
+
+      Time::point deadline = Time::now() + BatchTime;
+
+      while (!exit && Time::now() < deadline)
+          sleepCondition.wait_for(mutex, int(deadline - Time::now()));
+
+      mutex.unlock();
+
+      write_pending();
+  }
+
+  write_pending();
+}
+
+} // namespace DGT
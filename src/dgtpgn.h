@@ -0,0 +1,65 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2012 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2012 Jean-Francois Romang
+  Copyright (C) 2012-2013 Shivkumar Shivaji
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DGTPGN_H_INCLUDED
+#define DGTPGN_H_INCLUDED
+
+#include <string>
+#include <vector>
+
+#include "thread.h"
+
+namespace DGT {
+
+/// PgnWriter keeps the games played on the board and writes them to the PGN
+/// file from its own thread, so that the DGT loop never waits for the disk.
+/// Writes are batched: the moves of a game are appended to the file at most
+/// once per batch, and the file itself acts as the journal, being only
+/// appended to. The text of each ply of the current game, the move and the
+/// comments before it, is kept, so that after a takeback the game is rebuilt
+/// with its comments: the whole file is then regenerated in a temporary file
+/// that replaces it, so that a crash leaves either the old or the new file.
+/// Each write is synced to the disk before the next one.
+
+class PgnWriter : public ThreadBase {
+public:
+  PgnWriter() : regenerate(false) {}
+  virtual void idle_loop();
+
+  void open(const std::string& fileName);
+  void append(const std::string& text);
+  void append_move(const std::string& text);
+  void new_game();
+  void take_back(size_t ply);
+  void sync();
+
+private:
+  void write_pending();
+
+  Mutex fileMutex;
+  std::string fileName, archive, current, pending, nextPly;
+  std::vector<std::string> plies;
+  bool regenerate;
+};
+
+} // namespace DGT
+
+#endif // #ifndef DGTPGN_H_INCLUDED
@@ -0,0 +1,830 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2012 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2012 Jean-Francois Romang
+  Copyright (C) 2012-2013 Shivkumar Shivaji
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/// dgtreplay is a headless harness for the DGT loop. It plays the board side of
+/// the virtual board protocol on one end of a socketpair and runs DGT::loop()
+/// on the other end, so that board sessions can be replayed, timed and checked
+/// without hardware. A session is a script of board steps, one per line:
+///
+///   wait <msec>              Let the engine work, scaled by --speed
+///   move <e2e4>              Play a move on the board: lift, capture, place
+///   lift <sq>, place <sq>    Lift a piece and put it back somewhere
+///   add <sq> <piece>         Put a piece, given as a FEN letter, on a square
+///   remove <sq>              Remove the piece on a square
+///   board <placement>        Set up the piece placement field of a FEN
+///   mode <name>              Select a play mode: book, analysis, training,
+///                            game or kibitz
+///   raw <hex bytes>          Send a raw board message
+///   reply                    Play the engine move shown on the clock
+///   takeback                 Take back the last move or reply step and let
+///                            the board settle, whatever the speed
+///   expect <text>            Wait until the clock shows a 6 character text
+///
+/// A PGN game can be replayed instead, in analysis mode, with --pgn. At the end
+/// the number of board changes sent and processed, the throughput and the
+/// latency report are printed.
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "bitboard.h"
+#include "dgt.h"
+#include "dgtgame.h"
+#include "dgttrace.h"
+#include "evaluate.h"
+#include "movegen.h"
+#include "notation.h"
+#include "position.h"
+#include "search.h"
+#include "thread.h"
+#include "tt.h"
+#include "ucioption.h"
+
+extern "C" unsigned char _characterToLcdCode(char c); // Clock segments, from dgtnix
+
+using std::string;
+using std::cout;
+using std::cerr;
+using std::endl;
+
+namespace {
+
+  // Messages of the virtual board protocol
+  const unsigned char SEND_BOARD = 0x42, CLOCK_MESSAGE = 0x2b;
+  const unsigned char BOARD_DUMP = 0x86, BWTIME = 0x8d, FIELD_UPDATE = 0x8e;
+  const size_t CLOCK_MESSAGE_SIZE = 13;
+
+  // Piece codes of the protocol, as indexes in this string
+  const string PieceCodes(" PRNBKQprnbkq");
+
+  const char* StartPlacement = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR";
+
+  // A play mode is selected by adding a white queen on the fifth rank
+  const char* ModeNames[] = { "book", "analysis", "training", "game", "kibitz" };
+
+  const int PieceGap = 50;         // Between the pieces of a move, in milliseconds
+  const int ReplyTimeout = 120000; // Longest wait for the engine, in milliseconds
+  const int DrainTimeout = 10000;  // Longest wait for the DGT loop at the end
+
+  enum StepType { WAIT, MOVE, LIFT, PLACE, ADD, REMOVE, BOARD, MODE, RAW, REPLY, TAKEBACK, EXPECT };
+
+  const char* StepNames[] = {
+    "wait", "move", "lift", "place", "add", "remove", "board", "mode", "raw", "reply",
+    "takeback", "expect"
+  };
+
+  struct Step {
+    StepType type;
+    string arg;
+    int line;
+  };
+
+  // The board array starts from A8, as in dgtnix
+  int square_index(const string& s) {
+
+    if (s.size() < 2 || s[0] < 'a' || s[0] > 'h' || s[1] < '1' || s[1] > '8')
+        return -1;
+
+    return ('8' - s[1]) * 8 + (s[0] - 'a');
+  }
+
+
+  /// BoardSimulator runs the script against the DGT loop, answering the board
+  /// queries and acknowledging the clock messages meanwhile.
+
+  class BoardSimulator : public ThreadBase {
+  public:
+    BoardSimulator() : start(false), speed(1.0), failed(false), eventsSent(0),
+                       eventsProcessed(0), startTime(0), endTime(0) {}
+    virtual void idle_loop();
+
+    volatile bool start;
+    int fd;
+    double speed;
+    std::vector<Step> steps;
+
+    bool failed;
+    int64_t eventsSent, eventsProcessed, startTime, endTime;
+
+  private:
+    bool run(const Step& step);
+    bool serve(int msec);
+    bool serve_until(volatile bool& condition, int msec);
+    bool drain(int msec);
+    void pause(int msec) { if (speed > 0) serve(int(msec / speed)); else serve(0); }
+    void read_command();
+    void send(const unsigned char* data, size_t size);
+    void set_square(int idx, char piece);
+    void set_board(const string& placement);
+    void play_move(const string& move);
+    bool take_back();
+    void clock_message(const unsigned char* msg);
+
+    char board[64];
+    char held;
+    string input;
+    std::vector<string> played; // Boards before each move played
+    unsigned char expected[6];
+    bool expecting;
+    volatile bool clockSeen, expectedSeen, replySeen;
+    string reply;
+  };
+
+
+  /// BoardSimulator::idle_loop() answers the driver initialization, waits for
+  /// the engine greeting on the clock, then runs the script. At the end, once
+  /// the DGT loop has processed the board changes, the socket is closed so that
+  /// the loop returns.
+
+  void BoardSimulator::idle_loop() {
+
+    for (int i = 0; i < 64; i++)
+        board[i] = ' ';
+
+    held = ' ';
+    expecting = clockSeen = expectedSeen = replySeen = false;
+    set_board(StartPlacement);
+
+    wait_for(start);
+
+    // The loop greets on the clock, then handles the initial board dump
+    if (!serve_until(clockSeen, ReplyTimeout) || !drain(DrainTimeout))
+    {
+        cerr << "No answer from the DGT loop" << endl;
+        failed = true;
+    }
+
+    // The report covers the script only
+    DGT::Latency.reset();
+    eventsSent = 0;
+    startTime = system_time_to_usec();
+
+    for (size_t i = 0; !failed && !exit && i < steps.size(); i++)
+    {
+        int64_t t = system_time_to_usec();
+
+        if (!run(steps[i]))
+        {
+            cerr << "Line " << steps[i].line << ": " << StepNames[steps[i].type]
+                 << " " << steps[i].arg << " failed" << endl;
+            failed = true;
+        }
+
+        // Selecting a mode and taking back wait for the board to settle,
+        // whatever the speed, and are left out of the replay time.
+        if (steps[i].type == MODE || steps[i].type == TAKEBACK)
+            startTime += system_time_to_usec() - t;
+    }
+
+    // Let the DGT loop catch up with the board changes sent
+    drain(DrainTimeout);
+
+    endTime = system_time_to_usec();
+    eventsProcessed = DGT::Latency.events_processed();
+
+    shutdown(fd, SHUT_RDWR);
+    close(fd);
+  }
+
+
+  /// BoardSimulator::run() plays one step of the script
+
+  bool BoardSimulator::run(const Step& step) {
+
+    std::istringstream is(step.arg);
+    string a, b;
+    is >> a >> b;
+
+    switch (step.type) {
+
+    case WAIT:
+        pause(atoi(a.c_str()));
+        return true;
+
+    case MOVE:
+        if (a.size() < 4 || square_index(a) < 0 || square_index(a.substr(2)) < 0)
+            return false;
+        play_move(a);
+        return true;
+
+    case LIFT:
+        if (square_index(a) < 0)
+            return false;
+        held = board[square_index(a)];
+        set_square(square_index(a), ' ');
+        return true;
+
+    case PLACE:
+        if (square_index(a) < 0)
+            return false;
+        set_square(square_index(a), held);
+        return true;
+
+    case ADD:
+        if (square_index(a) < 0 || b.size() != 1 || PieceCodes.find(b[0]) == string::npos)
+            return false;
+        set_square(square_index(a), b[0]);
+        return true;
+
+    case REMOVE:
+        if (square_index(a) < 0)
+            return false;
+        set_square(square_index(a), ' ');
+        return true;
+
+    case BOARD:
+        set_board(a);
+        return true;
+
+    case MODE:
+        for (int m = 0; m < 5; m++)
+            if (a == ModeNames[m])
+            {
+                // The command board must settle, whatever the speed
+                int settle = 2 * int(Options["DGT Settle Time"]);
+                int idx = square_index(string(1, char('a' + m)) + "5");
+                set_square(idx, 'Q');
+                serve(settle);
+                set_square(idx, ' ');
+                serve(settle);
+                return true;
+            }
+        return false;
+
+    case RAW:
+    {
+        std::vector<unsigned char> data;
+        unsigned int byte;
+
+        for (std::istringstream hex(step.arg); hex >> std::hex >> byte; )
+            data.push_back((unsigned char)byte);
+
+        if (data.empty())
+            return false;
+
+        send(&data[0], data.size());
+        eventsSent += (data[0] == FIELD_UPDATE || data[0] == BOARD_DUMP);
+        return true;
+    }
+
+    case REPLY:
+        if (!serve_until(replySeen, ReplyTimeout))
+            return false;
+        play_move(reply);
+        return true;
+
+    case TAKEBACK:
+        return take_back();
+
+    case EXPECT:
+        if (a.size() > 6)
+            return false;
+        a.resize(6, ' ');
+        for (int i = 0; i < 6; i++)
+            expected[i] = _characterToLcdCode(a[i]);
+        expectedSeen = false;
+        expecting = true;
+        return serve_until(expectedSeen, ReplyTimeout);
+    }
+
+    return false;
+  }
+
+
+  /// BoardSimulator::play_move() moves the pieces of a move in UCI notation the
+  /// way a player does: the moving piece is lifted first, the captured piece
+  /// removed, then the moving piece placed. The rook follows the king when
+  /// castling and a promotion suffix replaces the pawn.
+
+  void BoardSimulator::play_move(const string& move) {
+
+    int from = square_index(move), to = square_index(move.substr(2));
+    char piece = board[from];
+    bool white = piece >= 'A' && piece <= 'Z';
+
+    played.push_back(string(board, 64));
+
+    set_square(from, ' ');
+    pause(PieceGap);
+
+    // En passant: a pawn moving diagonally to an empty square
+    if ((piece == 'P' || piece == 'p') && (from - to) % 8 && board[to] == ' ')
+    {
+        set_square(from - from % 8 + to % 8, ' ');
+        pause(PieceGap);
+    }
+    else if (board[to] != ' ')
+    {
+        set_square(to, ' ');
+        pause(PieceGap);
+    }
+
+    if (move.size() > 4 && move[4] != ' ')
+        piece = char(white ? toupper(move[4]) : move[4]);
+
+    set_square(to, piece);
+
+    if ((piece == 'K' || piece == 'k') && abs(to - from) == 2)
+    {
+        int rookFrom = to > from ? from + 3 : from - 4, rookTo = (from + to) / 2;
+        char rook = board[rookFrom];
+
+        pause(PieceGap);
+        set_square(rookFrom, ' ');
+        pause(PieceGap);
+        set_square(rookTo, rook);
+    }
+
+    replySeen = false;
+  }
+
+
+  /// BoardSimulator::take_back() restores the board as it was before the last
+  /// move played, whoever played it, so that a script needs not know the engine
+  /// reply. The pieces are lifted first, then put back. Each ply taken back must
+  /// settle to be seen by the DGT loop, so the settle window is waited for even
+  /// when the board changes are sent as fast as possible.
+
+  bool BoardSimulator::take_back() {
+
+    if (played.empty())
+        return false;
+
+    string before = played.back();
+    played.pop_back();
+
+    for (int i = 0; i < 64; i++)
+        if (board[i] != before[i] && board[i] != ' ')
+        {
+            set_square(i, ' ');
+            pause(PieceGap);
+        }
+
+    for (int i = 0; i < 64; i++)
+        if (board[i] != before[i])
+        {
+            set_square(i, before[i]);
+            pause(PieceGap);
+        }
+
+    serve(2 * int(Options["DGT Settle Time"]));
+    return true;
+  }
+
+
+  /// BoardSimulator::set_square() changes a square and sends the field update
+
+  void BoardSimulator::set_square(int idx, char piece) {
+
+    unsigned char msg[] = { FIELD_UPDATE, 0, 5, (unsigned char)idx,
+                            (unsigned char)PieceCodes.find(piece) };
+    board[idx] = piece;
+    send(msg, sizeof(msg));
+    eventsSent++;
+    replySeen = false;
+  }
+
+
+  /// BoardSimulator::set_board() reaches a piece placement square by square
+
+  void BoardSimulator::set_board(const string& placement) {
+
+    char target[64];
+    int idx = 0;
+
+    for (int i = 0; i < 64; i++)
+        target[i] = ' ';
+
+    for (size_t i = 0; i < placement.size() && idx < 64; i++)
+        if (placement[i] >= '1' && placement[i] <= '8')
+            idx += placement[i] - '0';
+        else if (placement[i] != '/')
+            target[idx++] = placement[i];
+
+    for (int i = 0; i < 64; i++)
+        if (board[i] != target[i])
+        {
+            if (start)
+                set_square(i, target[i]);
+            else
+                board[i] = target[i]; // Not connected yet, just the board dump
+        }
+  }
+
+
+  /// BoardSimulator::serve() handles the engine commands for the given time,
+  /// returns false when the DGT loop is gone. serve_until() stops as soon as
+  /// the condition set by a clock message holds.
+
+  bool BoardSimulator::serve(int msec) {
+
+    Time::point deadline = Time::now() + msec;
+
+    do {
+        pollfd p = { fd, POLLIN, 0 };
+        int timeout = int(std::max(deadline - Time::now(), Time::point(0)));
+
+        if (poll(&p, 1, timeout) < 0)
+            return false;
+
+        if (p.revents & (POLLERR | POLLHUP))
+            return false;
+
+        if (p.revents & POLLIN)
+            read_command();
+
+    } while (Time::now() < deadline && !exit);
+
+    return true;
+  }
+
+  bool BoardSimulator::serve_until(volatile bool& condition, int msec) {
+
+    Time::point deadline = Time::now() + msec;
+
+    while (!condition && !exit && Time::now() < deadline)
+        if (!serve(10))
+            return false;
+
+    return condition;
+  }
+
+  bool BoardSimulator::drain(int msec) {
+
+    Time::point deadline = Time::now() + msec;
+
+    while (DGT::Latency.events_processed() < eventsSent && !exit && Time::now() < deadline)
+        if (!serve(10))
+            return false;
+
+    return DGT::Latency.events_processed() >= eventsSent;
+  }
+
+
+  /// BoardSimulator::read_command() reads and answers the commands sent by the
+  /// driver. Commands without an answer, as the reset, are ignored.
+
+  void BoardSimulator::read_command() {
+
+    char buf[256];
+    ssize_t n = read(fd, buf, sizeof(buf));
+
+    if (n <= 0)
+        return;
+
+    input.append(buf, n);
+
+    while (!input.empty())
+    {
+        unsigned char c = input[0];
+
+        if (c == CLOCK_MESSAGE)
+        {
+            if (input.size() < CLOCK_MESSAGE_SIZE)
+                break;
+
+            unsigned char ack[] = { BWTIME, 0, 10, 0, 0, 0, 0x0a, 0, 0, 0 };
+            clock_message((const unsigned char*)input.data());
+            input.erase(0, CLOCK_MESSAGE_SIZE);
+            send(ack, sizeof(ack));
+        }
+        else if (c == SEND_BOARD)
+        {
+            unsigned char dump[67] = { BOARD_DUMP, 0, 67 };
+
+            for (int i = 0; i < 64; i++)
+                dump[3 + i] = (unsigned char)PieceCodes.find(board[i]);
+
+            input.erase(0, 1);
+            send(dump, sizeof(dump));
+            eventsSent++;
+        }
+        else
+            input.erase(0, 1);
+    }
+  }
+
+
+  /// BoardSimulator::clock_message() decodes a clock message. A move shown with
+  /// a beep is taken as the engine reply.
+
+  void BoardSimulator::clock_message(const unsigned char* msg) {
+
+    // The six characters are sent in the order C B A F E D. A move reads as
+    // "e2 e4 " or "e7 e8q", with some characters, as '1' and 'i', looking the
+    // same on the clock, so each position is decoded as what a move holds.
+    const int Order[] = { 6, 5, 4, 9, 8, 7 };
+    const char* MoveChars[] = { "abcdefgh", "12345678", " ", "abcdefgh", "12345678", " qrbn" };
+    string text;
+
+    for (int i = 0; i < 6; i++)
+    {
+        char ch = '?';
+
+        for (const char* p = MoveChars[i]; *p; p++)
+            if (_characterToLcdCode(*p) == msg[Order[i]])
+                ch = *p;
+
+        text += ch;
+    }
+
+    if (expecting)
+    {
+        bool same = true;
+
+        for (int i = 0; i < 6; i++)
+            same = same && msg[Order[i]] == expected[i];
+
+        if (same)
+        {
+            expecting = false;
+            expectedSeen = true;
+        }
+    }
+
+    if (msg[11] == 0x03 && text.find('?') == string::npos)
+    {
+        reply = text.substr(0, 2) + text.substr(3, 2) + (text[5] != ' ' ? text.substr(5) : "");
+        replySeen = true;
+    }
+
+    clockSeen = true;
+  }
+
+  void BoardSimulator::send(const unsigned char* data, size_t size) {
+
+    if (write(fd, data, size) != ssize_t(size))
+        cerr << "Write to the DGT loop failed" << endl;
+  }
+
+
+  // parse_script() reads the steps of a script file
+
+  bool parse_script(const string& fileName, std::vector<Step>& steps) {
+
+    std::ifstream file(fileName.c_str());
+    string line, token;
+
+    if (!file.is_open())
+    {
+        cerr << "Unable to open " << fileName << endl;
+        return false;
+    }
+
+    for (int n = 1; std::getline(file, line); n++)
+    {
+        line = line.substr(0, line.find('#'));
+        std::istringstream is(line);
+
+        if (!(is >> token))
+            continue;
+
+        Step step;
+        step.line = n;
+        std::getline(is >> std::ws, step.arg);
+
+        int t = 0;
+        while (t <= EXPECT && token != StepNames[t])
+            t++;
+
+        if (t > EXPECT)
+        {
+            cerr << fileName << ":" << n << ": unknown step " << token << endl;
+            return false;
+        }
+
+        step.type = StepType(t);
+        steps.push_back(step);
+    }
+
+    return true;
+  }
+
+
+  // parse_pgn() turns the moves of the first game of a PGN file into steps,
+  // played in analysis mode with the given thinking time between moves.
+
+  bool parse_pgn(const string& fileName, int think, std::vector<Step>& steps) {
+
+    std::ifstream file(fileName.c_str());
+    std::stringstream text;
+    string token;
+    int depth = 0;
+
+    if (!file.is_open())
+    {
+        cerr << "Unable to open " << fileName << endl;
+        return false;
+    }
+
+    // Drop the tags, the comments and the variations
+    for (string line; std::getline(file, line); )
+    {
+        if (!line.empty() && line[0] == '[')
+            continue;
+
+        for (size_t i = 0; i < line.size(); i++)
+        {
+            char c = line[i];
+            depth += (c == '{' || c == '(') - (c == '}' || c == ')');
+
+            if (!depth && c != '}' && c != ')')
+                text << c;
+        }
+        text << ' ';
+    }
+
+    static DGT::GameState game; // Large, keep it off the stack
+    game.reset("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
+
+    Step step;
+    step.line = 0;
+    step.type = MODE;
+    step.arg = "analysis";
+    steps.push_back(step);
+
+    while (text >> token)
+    {
+        if (token.find('.') != string::npos)
+            token = token.substr(token.rfind('.') + 1);
+
+        if (token.empty() || token == "*" || token == "1-0" || token == "0-1" || token == "1/2-1/2")
+            continue;
+
+        for (size_t i = 0; i < token.size(); i++)
+            if (token[i] == '0')
+                token[i] = 'O';
+
+        token = token.substr(0, token.find_first_of("+#!?"));
+        Position& pos = game.position();
+        Move m = MOVE_NONE;
+
+        for (MoveList<LEGAL> ml(pos); *ml && m == MOVE_NONE; ++ml)
+        {
+            string san = move_to_san(pos, *ml);
+
+            if (san.substr(0, san.find_first_of("+#")) == token)
+                m = *ml;
+        }
+
+        if (m == MOVE_NONE)
+        {
+            cerr << fileName << ": illegal move " << token << endl;
+            return false;
+        }
+
+        step.type = MOVE;
+        step.arg = move_to_uci(m, false);
+        steps.push_back(step);
+
+        step.type = WAIT;
+        std::stringstream ss;
+        ss << think;
+        step.arg = ss.str();
+        steps.push_back(step);
+
+        game.push_back(m);
+    }
+
+    return true;
+  }
+
+  void usage() {
+
+    cerr << "Usage: dgtreplay [--speed <factor>] [--think <msec>]"
+         << " [--setoption <name>=<value>]... [--pgn <file>] [<script>]" << endl
+         << "A speed of 0 sends the board changes as fast as possible." << endl;
+  }
+
+} // namespace
+
+
+int main(int argc, char* argv[]) {
+
+  std::cout << engine_info() << std::endl;
+
+  UCI::init(Options);
+  Bitboards::init();
+  Position::init();
+  Bitbases::init_kpk();
+  Search::init();
+  Eval::init();
+  Threads.init();
+  TT.set_size(Options["Hash"]);
+
+  std::vector<Step> steps;
+  std::vector<string> options;
+  string script, pgn;
+  double speed = 1.0;
+  int think = 1000;
+
+  for (int i = 1; i < argc; i++)
+  {
+      string arg = argv[i];
+
+      if (arg == "--speed" && i + 1 < argc)
+          speed = atof(argv[++i]);
+
+      else if (arg == "--think" && i + 1 < argc)
+          think = atoi(argv[++i]);
+
+      else if (arg == "--setoption" && i + 1 < argc)
+          options.push_back(argv[++i]);
+
+      else if (arg == "--pgn" && i + 1 < argc)
+          pgn = argv[++i];
+
+      else if (arg[0] != '-' && script.empty())
+          script = arg;
+
+      else
+      {
+          usage();
+          return 1;
+      }
+  }
+
+  if (   (script.empty() && pgn.empty())
+      || (!script.empty() && !parse_script(script, steps))
+      || (!pgn.empty() && !parse_pgn(pgn, think, steps)))
+  {
+      if (script.empty() && pgn.empty())
+          usage();
+
+      Threads.exit();
+      return 1;
+  }
+
+  for (size_t i = 0; i < options.size(); i++)
+  {
+      size_t eq = options[i].find('=');
+      UCI::loop("setoption name " + options[i].substr(0, eq)
+                + (eq != string::npos ? " value " + options[i].substr(eq + 1) : ""));
+  }
+
+  int sv[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+  {
+      perror("socketpair");
+      Threads.exit();
+      return 1;
+  }
+
+  BoardSimulator* sim = new_thread<BoardSimulator>();
+  sim->fd = sv[0];
+  sim->speed = speed;
+  sim->steps = steps;
+  sim->start = true;
+  sim->notify_one();
+
+  std::stringstream port;
+  port << "fd:" << sv[1];
+  DGT::loop(port.str());
+
+  bool failed = sim->failed;
+  int64_t sent = sim->eventsSent, processed = sim->eventsProcessed;
+  int64_t elapsed = std::max(sim->endTime - sim->startTime, int64_t(1));
+  delete_thread(sim);
+
+  cout << "\n==========================="
+       << "\nBoard changes sent  : " << sent
+       << "\nBoard changes done  : " << processed
+       << "\nReplay time (ms)    : " << elapsed / 1000
+       << "\nChanges/second      : " << std::fixed << std::setprecision(1) << processed * 1e6 / elapsed
+       << "\n\n" << DGT::Latency.report() << endl;
+
+  Threads.exit();
+
+  return failed || processed != sent;
+}
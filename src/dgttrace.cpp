@@ -0,0 +1,359 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2012 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2012 Jean-Francois Romang
+  Copyright (C) 2012-2013 Shivkumar Shivaji
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+
+#include "dgttrace.h"
+#include "notation.h"
+
+using std::string;
+
+namespace {
+
+  const char* StageNames[] = {
+    "total", "queue", "settle", "recognize", "book",
+    "search start", "search", "schedule", "display"
+  };
+
+  inline int64_t now() { return system_time_to_usec(); }
+
+  // Milliseconds with one decimal, for the report and the log
+  string msec(int64_t usec) {
+
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(1) << usec / 1000.0;
+    return ss.str();
+  }
+
+  // Upper bound of a histogram bucket, for the report
+  string bucket_bound(int b) {
+
+    std::stringstream ss;
+    int64_t usec = int64_t(2) << b;
+
+    if (usec < 1000)
+        ss << usec << "us";
+    else
+        ss << usec / 1000 << "ms";
+
+    return ss.str();
+  }
+
+  // One row of the report: the summary of a histogram and its buckets
+  void print_row(std::stringstream& ss, const char* name, const DGT::Histogram& h) {
+
+    ss << std::left << std::setw(14) << name << std::right
+       << std::setw(7)  << h.count
+       << std::setw(10) << msec(h.min)
+       << std::setw(10) << msec(h.sum / h.count)
+       << std::setw(10) << msec(h.percentile(50))
+       << std::setw(10) << msec(h.percentile(90))
+       << std::setw(10) << msec(h.percentile(99))
+       << std::setw(10) << msec(h.max) << "\n";
+
+    ss << std::setw(14) << "";
+
+    for (int b = 0; b < DGT::HISTOGRAM_BUCKETS; b++)
+        if (h.buckets[b])
+            ss << " <" << bucket_bound(b) << ":" << h.buckets[b];
+
+    ss << "\n";
+  }
+}
+
+namespace DGT {
+
+LatencyTrace Latency; // Global object
+
+
+/// Histogram::clear() empties the histogram and Histogram::add() adds a sample
+
+void Histogram::clear() {
+
+  std::memset(this, 0, sizeof(Histogram));
+}
+
+void Histogram::add(int64_t usec) {
+
+  int b = 0;
+
+  while (b < HISTOGRAM_BUCKETS - 1 && usec >= (int64_t(2) << b))
+      b++;
+
+  if (!count || usec < min)
+      min = usec;
+
+  if (!count || usec > max)
+      max = usec;
+
+  count++;
+  sum += usec;
+  buckets[b]++;
+}
+
+
+/// Histogram::percentile() returns the upper bound of the bucket holding the
+/// p-th percentile sample, or the largest sample if it is lower.
+
+int64_t Histogram::percentile(int p) const {
+
+  int64_t rank = (count * p + 99) / 100, seen = 0;
+
+  for (int b = 0; b < HISTOGRAM_BUCKETS; b++)
+      if ((seen += buckets[b]) >= rank && seen)
+          return std::min(int64_t(2) << b, max);
+
+  return max;
+}
+
+
+/// LatencyTrace::reset() forgets the current trace and the latencies so far
+
+void LatencyTrace::reset() {
+
+  mutex.lock();
+
+  for (int s = 0; s < LAT_STAGE_NB; s++)
+      histograms[s].clear();
+
+  eventHistogram.clear();
+  eventHead = eventTail = 0;
+  lastBoard = lastDequeue = lastSettle = 0;
+  active = false;
+  clockId = lastDisplayedId = 0;
+  lastDisplayedTime = 0;
+  move = MOVE_NONE;
+  pendingLog.clear();
+
+  mutex.unlock();
+}
+
+
+/// LatencyTrace::board_changed(), board_dequeued() and board_settled() note the
+/// time of the last board change as it goes through the DGT loop. Most of the
+/// board changes are not moves, a trace starts only when a move is recognized.
+
+void LatencyTrace::board_changed() {
+
+  int64_t t = now();
+  mutex.lock();
+  lastBoard = t;
+
+  if (eventTail - eventHead < MAX_PENDING_EVENTS)
+      eventTimes[eventTail++ % MAX_PENDING_EVENTS] = t;
+
+  mutex.unlock();
+}
+
+void LatencyTrace::board_dequeued() {
+
+  int64_t t = now();
+  mutex.lock();
+  lastDequeue = t;
+  mutex.unlock();
+}
+
+void LatencyTrace::board_settled() {
+
+  int64_t t = now();
+  mutex.lock();
+  lastSettle = t;
+  mutex.unlock();
+}
+
+
+/// LatencyTrace::board_processed() is called by the DGT loop when it is done
+/// with a board change. Changes are processed in the order they were queued.
+
+void LatencyTrace::board_processed() {
+
+  int64_t t = now();
+  mutex.lock();
+
+  if (eventHead < eventTail)
+      eventHistogram.add(t - eventTimes[eventHead++ % MAX_PENDING_EVENTS]);
+
+  if (eventHead == eventTail)
+      eventHead = eventTail = 0;
+
+  mutex.unlock();
+}
+
+int64_t LatencyTrace::events_processed() const {
+
+  mutex.lock();
+  int64_t n = eventHistogram.count;
+  mutex.unlock();
+
+  return n;
+}
+
+
+/// LatencyTrace::move_recognized() starts the trace of a board move. A move
+/// whose reply was not displayed yet, as when the player takes it back, is
+/// not traced.
+
+void LatencyTrace::move_recognized(Move m) {
+
+  int64_t t = now();
+  mutex.lock();
+
+  for (int s = 0; s < LAT_STAGE_NB; s++)
+      stamps[s] = 0;
+
+  stamps[LAT_BOARD]     = lastBoard;
+  stamps[LAT_DEQUEUE]   = lastDequeue;
+  stamps[LAT_SETTLE]    = lastSettle;
+  stamps[LAT_RECOGNIZE] = t;
+  active = true;
+  clockId = 0;
+  move = m;
+
+  mutex.unlock();
+}
+
+void LatencyTrace::stamp(LatencyStage s) {
+
+  int64_t t = now();
+  mutex.lock();
+
+  if (active && !stamps[s])
+      stamps[s] = t;
+
+  mutex.unlock();
+}
+
+/// LatencyTrace::scheduled() is called with the identifier of the clock message
+/// of the engine move. The clock may acknowledge it before we get here.
+
+void LatencyTrace::scheduled(int clockMessageId) {
+
+  int64_t t = now();
+  mutex.lock();
+
+  if (active && !clockId && clockMessageId)
+  {
+      stamps[LAT_SCHEDULE] = t;
+      clockId = clockMessageId;
+
+      if (clockId == lastDisplayedId)
+          complete(std::max(t, lastDisplayedTime));
+  }
+
+  mutex.unlock();
+}
+
+
+/// LatencyTrace::displayed() is called on the driver thread for every clock
+/// message acknowledged. When this is the engine move, the trace is complete.
+
+void LatencyTrace::displayed(int clockMessageId) {
+
+  int64_t t = now();
+  mutex.lock();
+
+  lastDisplayedId = clockMessageId;
+  lastDisplayedTime = t;
+
+  if (active && clockId && clockId == clockMessageId)
+      complete(t);
+
+  mutex.unlock();
+}
+
+
+/// LatencyTrace::complete() adds the latencies of the current trace to the
+/// histograms and queues its log line. Called with the mutex held.
+
+void LatencyTrace::complete(int64_t t) {
+
+  std::stringstream log;
+  int64_t prev = stamps[LAT_BOARD];
+
+  stamps[LAT_DISPLAY] = t;
+  log << "move " << move_to_uci(move, false);
+
+  for (int s = LAT_DEQUEUE; s < LAT_STAGE_NB; s++)
+      if (stamps[s] && prev && stamps[s] >= prev)
+      {
+          histograms[s].add(stamps[s] - prev);
+          log << " " << StageNames[s] << " " << msec(stamps[s] - prev);
+          prev = stamps[s];
+      }
+
+  if (stamps[LAT_BOARD])
+  {
+      histograms[LAT_BOARD].add(t - stamps[LAT_BOARD]);
+      log << " total " << msec(t - stamps[LAT_BOARD]);
+  }
+
+  pendingLog += log.str() + "\n";
+  active = false;
+}
+
+
+/// LatencyTrace::take_log() returns the log lines of the traces completed since
+/// the last call
+
+string LatencyTrace::take_log() {
+
+  mutex.lock();
+  string s = pendingLog;
+  pendingLog.clear();
+  mutex.unlock();
+
+  return s;
+}
+
+
+/// LatencyTrace::report() formats the histograms, in milliseconds
+
+string LatencyTrace::report() const {
+
+  std::stringstream ss;
+
+  mutex.lock();
+
+  ss << std::left << std::setw(14) << "stage (ms)" << std::right
+     << std::setw(7) << "count" << std::setw(10) << "min" << std::setw(10) << "avg"
+     << std::setw(10) << "p50"  << std::setw(10) << "p90" << std::setw(10) << "p99"
+     << std::setw(10) << "max"  << "\n";
+
+  if (eventHistogram.count)
+      print_row(ss, "board event", eventHistogram);
+
+  for (int s = LAT_DEQUEUE; s <= LAT_STAGE_NB; s++)
+  {
+      int i = s < LAT_STAGE_NB ? s : LAT_BOARD; // The total comes last
+
+      if (histograms[i].count)
+          print_row(ss, StageNames[i], histograms[i]);
+  }
+
+  mutex.unlock();
+
+  return ss.str();
+}
+
+} // namespace DGT
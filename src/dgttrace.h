@@ -0,0 +1,114 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2012 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2012 Jean-Francois Romang
+  Copyright (C) 2012-2013 Shivkumar Shivaji
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DGTTRACE_H_INCLUDED
+#define DGTTRACE_H_INCLUDED
+
+#include <string>
+
+#include "thread.h"
+#include "types.h"
+
+namespace DGT {
+
+/// The stages a board move goes through until the engine reply is shown on
+/// the clock. The latency of a stage is the time elapsed since the previous
+/// stage reached, so the stages skipped by a move, as the search for a book
+/// move, do not count. LAT_BOARD starts the trace and holds the total latency.
+
+enum LatencyStage {
+  LAT_BOARD,        // Last board change of the move, on the dgtnix driver thread
+  LAT_DEQUEUE,      // Board change popped by the DGT loop
+  LAT_SETTLE,       // Board settled
+  LAT_RECOGNIZE,    // Board recognized as a move of the game
+  LAT_BOOK,         // Book probed
+  LAT_SEARCH_START, // Search started, or ponderhit
+  LAT_SEARCH,       // Search finished
+  LAT_SCHEDULE,     // Engine move scheduled on the clock
+  LAT_DISPLAY,      // Engine move acknowledged by the clock
+  LAT_STAGE_NB
+};
+
+
+/// Histogram counts latencies in power of two buckets of microseconds: bucket
+/// i holds the samples below 2^(i+1) usec not in a previous bucket.
+
+const int HISTOGRAM_BUCKETS = 32;
+
+struct Histogram {
+
+  void clear();
+  void add(int64_t usec);
+  int64_t percentile(int p) const;
+
+  int64_t count, sum, min, max;
+  int64_t buckets[HISTOGRAM_BUCKETS];
+};
+
+
+/// LatencyTrace timestamps the stages of the current move and accumulates the
+/// latencies of the moves traced so far, from the DGT loop and the dgtnix
+/// driver thread. Completed traces are also kept as log lines until the DGT
+/// loop takes them, so that no file is written from the driver thread.
+/// Independently of the moves, every board change is timed from the driver
+/// callback until the DGT loop is done with it.
+
+const int MAX_PENDING_EVENTS = 1024;
+
+class LatencyTrace {
+public:
+  LatencyTrace() { reset(); }
+
+  void reset();
+  void board_changed();
+  void board_dequeued();
+  void board_settled();
+  void board_processed();
+  int64_t events_processed() const;
+  void move_recognized(Move m);
+  void stamp(LatencyStage s);
+  void scheduled(int clockMessageId);
+  void displayed(int clockMessageId);
+  std::string take_log();
+  std::string report() const;
+
+private:
+  void complete(int64_t t);
+
+  mutable Mutex mutex;
+  int64_t lastBoard, lastDequeue, lastSettle;
+  int64_t stamps[LAT_STAGE_NB];
+  bool active;
+  int clockId, lastDisplayedId;
+  int64_t lastDisplayedTime;
+  Move move;
+  Histogram histograms[LAT_STAGE_NB];
+  Histogram eventHistogram;
+  int64_t eventTimes[MAX_PENDING_EVENTS];
+  int eventHead, eventTail;
+  std::string pendingLog;
+};
+
+extern LatencyTrace Latency;
+
+} // namespace DGT
+
+#endif // #ifndef DGTTRACE_H_INCLUDED
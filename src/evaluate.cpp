@@ -524,7 +524,7 @@ Value do_evaluate(const Position& pos, Value& margin) {
         // give a discovered check through an x-ray attack.
         else if (    Piece == BISHOP
                  && (PseudoAttacks[Piece][pos.king_square(Them)] & s)
-                 && !more_than_one(BetweenBB[s][pos.king_square(Them)] & pos.pieces()))
+                 && !more_than_one(between_bb(s, pos.king_square(Them)) & pos.pieces()))
                  score += BishopPin;
 
         // Penalty for bishop with same coloured pawns
@@ -22,28 +22,108 @@
 
 #include "bitboard.h"
 #include "evaluate.h"
+#include "misc.h"
 #include "position.h"
 #include "search.h"
 #include "thread.h"
 #include "tt.h"
 #include "ucioption.h"
 
+namespace {
+
+  typedef void (Stage)();
+
+  bool ProfileStartup; // Print the time of each initialization stage
+
+  // run_stage() runs an initialization stage, timing it if asked to
+  void run_stage(const char* name, Stage stage) {
+
+    int64_t start = system_time_to_usec();
+
+    stage();
+
+    if (ProfileStartup)
+        sync_cout << "info string startup " << name << " "
+                  << system_time_to_usec() - start << " us" << sync_endl;
+  }
+
+  // StageThread runs a stage while main() goes on with the ones that do not
+  // depend on it. It is joined with delete_thread().
+  struct StageThread : public ThreadBase {
+
+    StageThread() : name(NULL), stage(NULL), started(false) {}
+    virtual void idle_loop() { wait_for(started); run_stage(name, stage); }
+
+    const char* name;
+    Stage* stage;
+    volatile bool started;
+  };
+
+  StageThread* start_stage(const char* name, Stage stage) {
+
+    StageThread* th = new_thread<StageThread>();
+    th->name = name;
+    th->stage = stage;
+    th->started = true;
+    th->notify_one();
+    return th;
+  }
+
+  void init_options()      { UCI::init(Options); }
+  void init_low_sliders()  { Bitboards::init_sliders(SQ_A1, SQ_H4); }
+  void init_high_sliders() { Bitboards::init_sliders(SQ_A5, SQ_H8); }
+  void init_threads()      { Threads.init(); }
+  void init_tt()           { TT.set_size(Options["Hash"]); }
+}
+
+
+/// main() initializes the engine, running at once the stages that do not
+/// depend on each other. The rook and bishop attacks of the two halves of the
+/// board are filled on two threads, Search::init(), Eval::init() and the hash
+/// table allocation meanwhile. With --startup-profile as first argument, the
+/// time of each stage is printed.
+
 int main(int argc, char* argv[]) {
 
   std::cout << engine_info() << std::endl;
 
-  UCI::init(Options);
-  Bitboards::init();
-  Position::init();
-  Bitbases::init_kpk();
-  Search::init();
-  Eval::init();
-  Threads.init();
-  TT.set_size(Options["Hash"]);
+  int64_t start = system_time_to_usec();
+  int first = 1;
+
+  if (argc > 1 && std::string(argv[1]) == "--startup-profile")
+  {
+      ProfileStartup = true;
+      first++;
+  }
+
+  run_stage("UCI::init", init_options);
+
+  StageThread* search  = start_stage("Search::init", Search::init);
+  StageThread* eval    = start_stage("Eval::init", Eval::init);
+  StageThread* tt      = start_stage("TT.set_size", init_tt);
+
+  run_stage("Bitboards::init_tables", Bitboards::init_tables);
+
+  StageThread* sliders = start_stage("Bitboards::init_sliders a5-h8", init_high_sliders);
+
+  run_stage("Bitboards::init_sliders a1-h4", init_low_sliders);
+  delete_thread(sliders);
+
+  run_stage("Position::init", Position::init);
+  run_stage("Bitbases::init_kpk", Bitbases::init_kpk);
+  run_stage("Threads.init", init_threads);
+
+  delete_thread(search);
+  delete_thread(eval);
+  delete_thread(tt);
+
+  if (ProfileStartup)
+      sync_cout << "info string startup total "
+                << system_time_to_usec() - start << " us" << sync_endl;
 
   std::string args;
 
-  for (int i = 1; i < argc; i++)
+  for (int i = first; i < argc; i++)
       args += std::string(argv[i]) + " ";
 
   UCI::loop(args);
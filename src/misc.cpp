@@ -21,6 +21,8 @@
 #include <iostream>
 #include <sstream>
 
+#include "bitboard.h"
+#include "bitcount.h"
 #include "misc.h"
 #include "thread.h"
 
@@ -51,7 +53,11 @@ const string engine_info(bool to_uci) {
   }
 
   s << (Is64Bit ? " 64" : "")
+#ifdef USE_CPUID
+    << (UsePext ? " BMI2" : UsePopCnt ? " SSE4.2" : "")
+#else
     << (HasPopCnt ? " SSE4.2" : "")
+#endif
     << (to_uci ? "\nid author ": " by ")
     << "Tord Romstad, Marco Costalba and Joona Kiiski";
 
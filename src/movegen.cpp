@@ -274,6 +274,170 @@ namespace {
   }
 
 
+
+  template<Color Us>
+  ExtMove* generate_legal_pawn_moves(const Position& pos, ExtMove* mlist,
+                                     Bitboard pawns, Bitboard target) {
+
+    const Color    Them     = (Us == WHITE ? BLACK    : WHITE);
+    const Bitboard TRank7BB = (Us == WHITE ? Rank7BB  : Rank2BB);
+    const Bitboard TRank3BB = (Us == WHITE ? Rank3BB  : Rank6BB);
+    const Square   Up       = (Us == WHITE ? DELTA_N  : DELTA_S);
+    const Square   Right    = (Us == WHITE ? DELTA_NE : DELTA_SW);
+    const Square   Left     = (Us == WHITE ? DELTA_NW : DELTA_SE);
+
+    Bitboard pawnsOn7    = pawns &  TRank7BB;
+    Bitboard pawnsNotOn7 = pawns & ~TRank7BB;
+    Bitboard emptySquares = ~pos.pieces();
+    Bitboard enemies = pos.pieces(Them) & target;
+
+    Bitboard b1 = shift_bb<Up>(pawnsNotOn7)   & emptySquares;
+    Bitboard b2 = shift_bb<Up>(b1 & TRank3BB) & emptySquares & target;
+    b1 &= target;
+
+    SERIALIZE_PAWNS(b1, Up);
+    SERIALIZE_PAWNS(b2, Up + Up);
+
+    if (pawnsOn7)
+    {
+        mlist = generate_promotions<NON_EVASIONS, Right>(mlist, pawnsOn7, enemies, NULL);
+        mlist = generate_promotions<NON_EVASIONS, Left >(mlist, pawnsOn7, enemies, NULL);
+        mlist = generate_promotions<NON_EVASIONS, Up>(mlist, pawnsOn7, emptySquares & target, NULL);
+    }
+
+    b1 = shift_bb<Right>(pawnsNotOn7) & enemies;
+    b2 = shift_bb<Left >(pawnsNotOn7) & enemies;
+
+    SERIALIZE_PAWNS(b1, Right);
+    SERIALIZE_PAWNS(b2, Left);
+
+    return mlist;
+  }
+
+
+  template<PieceType Pt>
+  ExtMove* generate_legal_moves(const Position& pos, ExtMove* mlist, Color us,
+                                Bitboard pinned, Bitboard target) {
+
+    const Square* pl = pos.list<Pt>(us);
+
+    for (Square from = *pl; from != SQ_NONE; from = *++pl)
+        if (!(pinned & from))
+        {
+            Bitboard b = pos.attacks_from<Pt>(from) & target;
+            SERIALIZE(b);
+        }
+
+    return mlist;
+  }
+
+
+  template<Color Us>
+  ExtMove* generate_legal(const Position& pos, ExtMove* mlist) {
+
+    const Color  Them = (Us == WHITE ? BLACK   : WHITE);
+    const Square Up   = (Us == WHITE ? DELTA_N : DELTA_S);
+
+    Square ksq = pos.king_square(Us), from = ksq /* For SERIALIZE */;
+    Bitboard checkers = pos.checkers();
+    Bitboard occupied = pos.pieces();
+    Bitboard b;
+
+    // King moves, the king is removed from the occupancy so that it does not
+    // shelter itself from a slider checking along the line of its move.
+    b = pos.attacks_from<KING>(ksq) & ~pos.pieces(Us);
+    while (b)
+    {
+        Square to = pop_lsb(&b);
+        if (!(pos.attackers_to(to, occupied ^ ksq) & pos.pieces(Them)))
+            (mlist++)->move = make_move(ksq, to);
+    }
+
+    if (more_than_one(checkers))
+        return mlist; // Double check, only a king move can save the day
+
+    // In check the other pieces must capture the checker or block the check
+    Bitboard target = checkers ? between_bb(ksq, lsb(checkers)) | checkers
+                               : ~pos.pieces(Us);
+
+    // Find our pinned pieces, a pinned piece can move only along the line
+    // between the king and its pinner, capture included, and never resolves
+    // a check given by another piece.
+    Bitboard pinned = 0;
+    Bitboard pinners = (  (pos.pieces(ROOK, QUEEN) & PseudoAttacks[ROOK][ksq])
+                        | (pos.pieces(BISHOP, QUEEN) & PseudoAttacks[BISHOP][ksq])) & pos.pieces(Them);
+    while (pinners)
+    {
+        Square pinner = pop_lsb(&pinners);
+        Bitboard line = between_bb(ksq, pinner);
+
+        b = line & occupied;
+        if (!b || more_than_one(b) || !(b & pos.pieces(Us)))
+            continue;
+
+        pinned |= b;
+
+        if (checkers)
+            continue;
+
+        from = lsb(b);
+        line |= pinner;
+
+        switch (type_of(pos.piece_on(from)))
+        {
+        case PAWN:
+            mlist = generate_legal_pawn_moves<Us>(pos, mlist, b, line);
+            break;
+        case KNIGHT:
+            break;
+        default:
+            b = pos.attacks_from(pos.piece_on(from), from) & line;
+            SERIALIZE(b);
+        }
+    }
+
+    mlist = generate_legal_pawn_moves<Us>(pos, mlist, pos.pieces(Us, PAWN) & ~pinned, target);
+    mlist = generate_legal_moves<KNIGHT>(pos, mlist, Us, pinned, target);
+    mlist = generate_legal_moves<BISHOP>(pos, mlist, Us, pinned, target);
+    mlist = generate_legal_moves<  ROOK>(pos, mlist, Us, pinned, target);
+    mlist = generate_legal_moves< QUEEN>(pos, mlist, Us, pinned, target);
+
+    // An en passant capture removes two pieces from the same rank, so it is
+    // verified as a whole: no enemy piece, but the captured pawn, may attack
+    // the king once the move has been made.
+    if (pos.ep_square() != SQ_NONE)
+    {
+        Square to = pos.ep_square(), capsq = to - Up;
+
+        b = pos.pieces(Us, PAWN) & pos.attacks_from<PAWN>(to, Them);
+        while (b)
+        {
+            from = pop_lsb(&b);
+            Bitboard occ = (occupied ^ from ^ capsq) | to;
+
+            if (!(pos.attackers_to(ksq, occ) & (pos.pieces(Them) ^ capsq)))
+                (mlist++)->move = make<ENPASSANT>(from, to);
+        }
+    }
+
+    // Castling moves are generated already verified
+    if (!checkers && pos.can_castle(Us))
+    {
+        if (pos.is_chess960())
+        {
+            mlist = generate_castle< KING_SIDE, false, true>(pos, mlist, Us);
+            mlist = generate_castle<QUEEN_SIDE, false, true>(pos, mlist, Us);
+        }
+        else
+        {
+            mlist = generate_castle< KING_SIDE, false, false>(pos, mlist, Us);
+            mlist = generate_castle<QUEEN_SIDE, false, false>(pos, mlist, Us);
+        }
+    }
+
+    return mlist;
+  }
+
 } // namespace
 
 
@@ -401,23 +565,13 @@ ExtMove* generate<EVASIONS>(const Position& pos, ExtMove* mlist) {
 }
 
 
-/// generate<LEGAL> generates all the legal moves in the given position
+/// generate<LEGAL> generates all the legal moves in the given position. Pins
+/// and checks are resolved while generating, so that no move is produced and
+/// later discarded by a legality test.
 
 template<>
 ExtMove* generate<LEGAL>(const Position& pos, ExtMove* mlist) {
 
-  ExtMove *end, *cur = mlist;
-  Bitboard pinned = pos.pinned_pieces();
-  Square ksq = pos.king_square(pos.side_to_move());
-
-  end = pos.checkers() ? generate<EVASIONS>(pos, mlist)
-                       : generate<NON_EVASIONS>(pos, mlist);
-  while (cur != end)
-      if (   (pinned || from_sq(cur->move) == ksq || type_of(cur->move) == ENPASSANT)
-          && !pos.pl_move_is_legal(cur->move, pinned))
-          cur->move = (--end)->move;
-      else
-          cur++;
-
-  return end;
+  return pos.side_to_move() == WHITE ? generate_legal<WHITE>(pos, mlist)
+                                     : generate_legal<BLACK>(pos, mlist);
 }
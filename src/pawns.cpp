@@ -248,8 +248,14 @@ Score Entry::update_safety(const Position& pos, Square ksq) {
   minKPdistance[Us] = 0;
 
   Bitboard pawns = pos.pieces(Us, PAWN);
+#ifdef COMPACT_TABLES
+  if (pawns)
+      for (minKPdistance[Us] = 7; pawns; )
+          minKPdistance[Us] = std::min(minKPdistance[Us], square_distance(ksq, pop_lsb(&pawns)));
+#else
   if (pawns)
       while (!(DistanceRingsBB[ksq][minKPdistance[Us]++] & pawns)) {}
+#endif
 
   if (relative_rank(Us, ksq) > RANK_4)
       return kingSafety[Us] = make_score(0, -16 * minKPdistance[Us]);
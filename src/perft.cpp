@@ -0,0 +1,340 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2013 Marco Costalba, Joona Kiiski, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cassert>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include "bitboard.h"
+#include "misc.h"
+#include "movegen.h"
+#include "notation.h"
+#include "perft.h"
+#include "position.h"
+#include "thread.h"
+#include "ucioption.h"
+
+using namespace std;
+
+namespace {
+
+  // A PerftEntry stores the leaf count of a subtree. The key is xor'ed with
+  // the data, so that an entry torn by two threads writing at once does not
+  // match any position and is simply a miss, without the need of a lock.
+  struct PerftEntry {
+    Key key;
+    uint64_t data; // Leaf count in the upper 56 bits, depth in the lower 8
+  };
+
+  const unsigned ClusterSize = 4; // A cluster is 64 Bytes
+
+  PerftEntry* Table;
+  void* Mem;
+  size_t HashMask;
+
+  // The root moves are shared among the threads, each one takes the next
+  // move to count from the list until it is exhausted.
+  const Position* RootPos;
+  int RootDepth;
+  vector<Move> RootMoves;
+  vector<uint64_t> RootCounts;
+  size_t NextRootMove;
+  Mutex RootMutex;
+
+
+  // set_size() allocates a cleared perft hash table of mbSize megabytes
+  void set_size(size_t mbSize) {
+
+    size_t size = ClusterSize << msb((mbSize << 20) / sizeof(PerftEntry[ClusterSize]));
+
+    HashMask = size - ClusterSize;
+    Mem = calloc(size * sizeof(PerftEntry) + CACHE_LINE_SIZE - 1, 1);
+
+    if (!Mem)
+    {
+        cerr << "Failed to allocate " << mbSize
+             << "MB for perft hash table." << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    Table = (PerftEntry*)((uintptr_t(Mem) + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1));
+  }
+
+
+  // free_table() releases the perft hash table once the run is over, so that
+  // its memory is not held on top of TT for the rest of the session.
+  void free_table() {
+
+    free(Mem);
+    Mem = NULL;
+    Table = NULL;
+  }
+
+
+  // probe() looks up the leaf count of the position at the given depth
+  bool probe(Key key, int depth, uint64_t& cnt) {
+
+    const PerftEntry* e = Table + (key & HashMask);
+
+    for (unsigned i = 0; i < ClusterSize; i++, e++)
+    {
+        uint64_t data = e->data;
+
+        if ((e->key ^ data) == key && int(data & 0xFF) == depth)
+        {
+            cnt = data >> 8;
+            return true;
+        }
+    }
+
+    return false;
+  }
+
+
+  // store() saves a leaf count in the cluster of the position, replacing the
+  // entry of the same position, if any, or else the shallowest one.
+  void store(Key key, int depth, uint64_t cnt) {
+
+    PerftEntry *e = Table + (key & HashMask), *replace = e;
+
+    for (unsigned i = 0; i < ClusterSize; i++, e++)
+    {
+        if ((e->key ^ e->data) == key)
+        {
+            replace = e;
+            break;
+        }
+
+        if ((e->data & 0xFF) < (replace->data & 0xFF))
+            replace = e;
+    }
+
+    uint64_t data = (cnt << 8) | uint64_t(depth);
+    replace->data = data;
+    replace->key = key ^ data;
+  }
+
+
+  // search() counts the leaf nodes at the given depth, at least 2. The moves
+  // of the last ply are not made, only counted.
+  uint64_t search(Position& pos, int depth) {
+
+    assert(depth >= 2);
+
+    uint64_t cnt = 0;
+
+    if (probe(pos.key(), depth, cnt))
+        return cnt;
+
+    StateInfo st;
+    CheckInfo ci(pos);
+
+    for (MoveList<LEGAL> it(pos); *it; ++it)
+    {
+        pos.do_move(*it, st, ci, pos.move_gives_check(*it, ci));
+        cnt += depth == 2 ? MoveList<LEGAL>(pos).size() : search(pos, depth - 1);
+        pos.undo_move(*it);
+    }
+
+    store(pos.key(), depth, cnt);
+    return cnt;
+  }
+
+
+  // count_root_moves() is run by each thread until all the root moves have
+  // been counted.
+  void count_root_moves(Thread* th) {
+
+    Position pos(*RootPos, th);
+    StateInfo st;
+
+    while (true)
+    {
+        RootMutex.lock();
+        size_t i = NextRootMove++;
+        RootMutex.unlock();
+
+        if (i >= RootMoves.size())
+            break;
+
+        pos.do_move(RootMoves[i], st);
+        RootCounts[i] = RootDepth == 2 ? MoveList<LEGAL>(pos).size()
+                                       : search(pos, RootDepth - 1);
+        pos.undo_move(RootMoves[i]);
+    }
+  }
+
+
+  // PerftThread helps the caller thread to count the root moves, then exits.
+  // It is joined with delete_thread().
+  struct PerftThread : public ThreadBase {
+
+    PerftThread() : th(NULL), started(false) {}
+    virtual void idle_loop() { wait_for(started); count_root_moves(th); }
+
+    Thread* th;
+    volatile bool started;
+  };
+}
+
+
+/// Perft::perft() returns the number of leaf nodes of the legal move tree of
+/// the given depth. With 'divide' the count of each root move is printed too.
+
+uint64_t Perft::perft(const Position& pos, int depth, bool divide) {
+
+  if (depth <= 0)
+      return 1;
+
+  RootMoves.clear();
+
+  for (MoveList<LEGAL> it(pos); *it; ++it)
+      RootMoves.push_back(*it);
+
+  RootCounts.assign(RootMoves.size(), 1);
+
+  if (depth > 1)
+  {
+      bool ownTable = !Table; // Else the table is the one of a running suite
+
+      if (ownTable)
+          set_size(Options["Perft Hash"]);
+
+      RootPos = &pos;
+      RootDepth = depth;
+      NextRootMove = 0;
+
+      vector<PerftThread*> helpers;
+
+      for (size_t i = 1; i < Threads.size() && i < RootMoves.size(); i++)
+      {
+          PerftThread* th = new_thread<PerftThread>();
+          th->th = Threads[i];
+          th->started = true;
+          th->notify_one();
+          helpers.push_back(th);
+      }
+
+      count_root_moves(Threads.main());
+
+      for (size_t i = 0; i < helpers.size(); i++)
+          delete_thread(helpers[i]);
+
+      if (ownTable)
+          free_table();
+  }
+
+  uint64_t cnt = 0;
+
+  for (size_t i = 0; i < RootMoves.size(); i++)
+  {
+      if (divide)
+          sync_cout << move_to_uci(RootMoves[i], pos.is_chess960())
+                    << ": " << RootCounts[i] << sync_endl;
+
+      cnt += RootCounts[i];
+  }
+
+  return cnt;
+}
+
+
+/// Perft::suite() verifies the leaf counts of the positions of an EPD file,
+/// where each line holds a FEN followed by the expected counts, as in
+///
+///   rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1 ;D1 20 ;D2 400
+///
+/// Depths above maxDepth are skipped. Returns true if all the counts match.
+
+bool Perft::suite(const string& fileName, int maxDepth) {
+
+  ifstream file(fileName.c_str());
+
+  if (!file.is_open())
+  {
+      cerr << "Unable to open file " << fileName << endl;
+      return false;
+  }
+
+  string line, token;
+  int tests = 0, failed = 0;
+  uint64_t nodes = 0;
+  Time::point elapsed = Time::now();
+
+  set_size(Options["Perft Hash"]); // Shared by all the runs of the suite
+
+  while (getline(file, line))
+  {
+      size_t semicolon = line.find(';');
+
+      if (line.empty() || semicolon == string::npos)
+          continue;
+
+      Position pos(line.substr(0, semicolon), Options["UCI_Chess960"], Threads.main());
+
+      sync_cout << pos.fen() << sync_endl;
+
+      for (size_t i = semicolon; i < line.size(); i++)
+          if (line[i] == ';')
+              line[i] = ' ';
+
+      istringstream is(line.substr(semicolon));
+      uint64_t expected;
+
+      while (is >> token >> expected)
+      {
+          int depth = atoi(token.c_str() + 1);
+
+          if (token[0] != 'D' || depth > maxDepth)
+              continue;
+
+          Time::point time = Time::now();
+          uint64_t cnt = perft(pos, depth);
+          time = Time::now() - time;
+
+          tests++;
+          nodes += cnt;
+
+          sync_cout << "  perft " << depth << " " << cnt
+                    << (cnt == expected ? " ok" : " FAILED") << " ("
+                    << time << " ms)" << sync_endl;
+
+          if (cnt != expected)
+          {
+              failed++;
+              sync_cout << "  expected " << expected << sync_endl;
+          }
+      }
+  }
+
+  free_table();
+
+  elapsed = Time::now() - elapsed + 1; // Assure positive to avoid a 'divide by zero'
+
+  sync_cout << "\n==========================="
+            << "\nTests passed    : " << tests - failed << '/' << tests
+            << "\nTotal time (ms) : " << elapsed
+            << "\nNodes searched  : " << nodes
+            << "\nNodes/second    : " << 1000 * nodes / elapsed << sync_endl;
+
+  return !failed;
+}
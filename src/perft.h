@@ -0,0 +1,42 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2013 Marco Costalba, Joona Kiiski, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PERFT_H_INCLUDED
+#define PERFT_H_INCLUDED
+
+#include <string>
+
+#include "types.h"
+
+class Position;
+
+/// Perft counts the leaf nodes of the legal move tree to verify the move
+/// generator and to benchmark the hardware. The root moves are shared among
+/// as many threads as set by the "Threads" option and the subtree counts are
+/// stored in a dedicated hash table of "Perft Hash" megabytes, allocated for
+/// the duration of a run only.
+
+namespace Perft {
+
+uint64_t perft(const Position& pos, int depth, bool divide = false);
+bool suite(const std::string& fileName, int maxDepth);
+
+}
+
+#endif // #ifndef PERFT_H_INCLUDED
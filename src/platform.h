@@ -52,6 +52,12 @@ inline int64_t system_time_to_msec() {
   return t.tv_sec * 1000LL + t.tv_usec / 1000;
 }
 
+inline int64_t system_time_to_usec() {
+  timeval t;
+  gettimeofday(&t, NULL);
+  return t.tv_sec * 1000000LL + t.tv_usec;
+}
+
 #  include <pthread.h>
 typedef pthread_mutex_t Lock;
 typedef pthread_cond_t WaitCondition;
@@ -69,6 +75,7 @@ typedef void*(*pt_start_fn)(void*);
 #  define cond_timedwait(x,y,z) pthread_cond_timedwait(&(x),&(y),z)
 #  define thread_create(x,f,t) pthread_create(&(x),NULL,(pt_start_fn)f,t)
 #  define thread_join(x) pthread_join(x, NULL)
+#  define memory_barrier() __sync_synchronize()
 
 #else // Windows and MinGW
 
@@ -80,6 +87,8 @@ inline int64_t system_time_to_msec() {
   return t.time * 1000LL + t.millitm;
 }
 
+inline int64_t system_time_to_usec() { return system_time_to_msec() * 1000; }
+
 #ifndef NOMINMAX
 #  define NOMINMAX // disable macros min() and max()
 #endif
@@ -110,6 +119,7 @@ inline DWORD* dwWin9xKludge() { static DWORD dw; return &dw; }
 #  define cond_timedwait(x,y,z) { lock_release(y); WaitForSingleObject(x,z); lock_grab(y); }
 #  define thread_create(x,f,t) (x = CreateThread(NULL,0,(LPTHREAD_START_ROUTINE)f,t,0,dwWin9xKludge()))
 #  define thread_join(x) { WaitForSingleObject(x, INFINITE); CloseHandle(x); }
+#  define memory_barrier() MemoryBarrier()
 
 #endif
 
@@ -55,6 +55,19 @@ namespace Zobrist {
   Key exclusion;
 }
 
+namespace {
+
+  // Cuckoo tables of the keys of the reversible moves, the xor of the keys of
+  // the piece on the two squares and of the side to move, and of the moves.
+  // A key is stored at either of its two hash indices. See Marcel van
+  // Kervinck's "Fast detection of upcoming repetitions".
+  Key Cuckoo[8192];
+  Move CuckooMove[8192];
+
+  inline int H1(Key k) { return int(k & 0x1FFF); }
+  inline int H2(Key k) { return int((k >> 16) & 0x1FFF); }
+}
+
 Key Position::exclusion_key() const { return st->key ^ Zobrist::exclusion;}
 
 namespace {
@@ -141,6 +154,39 @@ void Position::init() {
   Zobrist::side = rk.rand<Key>();
   Zobrist::exclusion  = rk.rand<Key>();
 
+  // Fill the cuckoo tables with the moves of the pieces, but pawns, between
+  // any two squares, a move and its reverse share the key.
+  int count = 0;
+
+  for (Color c = WHITE; c <= BLACK; c++)
+      for (PieceType pt = KNIGHT; pt <= KING; pt++)
+          for (Square s1 = SQ_A1; s1 <= SQ_H8; s1++)
+              for (Square s2 = Square(s1 + 1); s2 <= SQ_H8; s2++)
+                  if (attacks_from(make_piece(c, pt), s1, 0) & s2)
+                  {
+                      Move move = make_move(s1, s2);
+                      Key key = Zobrist::psq[c][pt][s1] ^ Zobrist::psq[c][pt][s2] ^ Zobrist::side;
+                      int i = H1(key);
+
+                      // Insert, moving the displaced entry to its other index
+                      // until an empty slot is found.
+                      while (true)
+                      {
+                          std::swap(Cuckoo[i], key);
+                          std::swap(CuckooMove[i], move);
+
+                          if (move == MOVE_NONE)
+                              break;
+
+                          i = (i == H1(key)) ? H2(key) : H1(key);
+                      }
+
+                      count++;
+                  }
+
+  assert(count == 3668);
+  (void)count;
+
   for (PieceType pt = PAWN; pt <= KING; pt++)
   {
       PieceValue[MG][make_piece(BLACK, pt)] = PieceValue[MG][pt];
@@ -163,8 +209,11 @@ void Position::init() {
 
 Position& Position::operator=(const Position& pos) {
 
-  std::memcpy(this, &pos, sizeof(Position));
-  startState = *st;
+  std::memcpy(this, &pos, size_t((char*)&startState - (char*)this));
+  startState = *pos.st;
+  ownCastleInfo = *pos.castleInfo;
+  castleInfo = &ownCastleInfo;
+  std::memcpy(keyFilter, pos.keyFilter, sizeof(keyFilter));
   st = &startState;
   nodes = 0;
 
@@ -174,6 +223,24 @@ Position& Position::operator=(const Position& pos) {
 }
 
 
+/// Position::Position() with a thread is the copy of 'pos' made by the slaves
+/// of a split point. Only the part that changes as moves are made is copied,
+/// the castling geometry is shared with 'pos' that must outlive the copy, as
+/// the master of a split point does.
+
+Position::Position(const Position& pos, Thread* th) {
+
+  std::memcpy(this, &pos, size_t((char*)&startState - (char*)this));
+  startState = *pos.st;
+  st = &startState;
+  nodes = 0;
+  thisThread = th;
+  set_key_filter();
+
+  assert(pos_is_ok());
+}
+
+
 /// Position::set() initializes the position object with the given FEN string.
 /// This function is not very robust - make sure that input FENs are correct,
 /// this is assumed to be the responsibility of the GUI.
@@ -287,13 +354,18 @@ void Position::set(const string& fenStr, bool isChess960, Thread* th) {
   gamePly = std::max(2 * (gamePly - 1), 0) + int(sideToMove == BLACK);
 
   st->key = compute_key();
+  keyFilter[st->key & (KeyFilterSize - 1)]++;
   st->pawnKey = compute_pawn_key();
   st->materialKey = compute_material_key();
   st->psq = compute_psq_score();
   st->npMaterial[WHITE] = compute_non_pawn_material(WHITE);
   st->npMaterial[BLACK] = compute_non_pawn_material(BLACK);
+#ifdef USE_ATTACK_MAPS
+  add_attacks(pieces(), 0);
+#endif
+
   st->checkersBB = attackers_to(king_square(sideToMove)) & pieces(~sideToMove);
-  chess960 = isChess960;
+  ownCastleInfo.chess960 = isChess960;
   thisThread = th;
 
   assert(pos_is_ok());
@@ -310,20 +382,40 @@ void Position::set_castle_right(Color c, Square rfrom) {
   CastleRight cr = make_castle_right(c, cs);
 
   st->castleRights |= cr;
-  castleRightsMask[kfrom] |= cr;
-  castleRightsMask[rfrom] |= cr;
-  castleRookSquare[c][cs] = rfrom;
+  ownCastleInfo.castleRightsMask[kfrom] |= cr;
+  ownCastleInfo.castleRightsMask[rfrom] |= cr;
+  ownCastleInfo.castleRookSquare[c][cs] = rfrom;
 
   Square kto = relative_square(c, cs == KING_SIDE ? SQ_G1 : SQ_C1);
   Square rto = relative_square(c, cs == KING_SIDE ? SQ_F1 : SQ_D1);
 
   for (Square s = std::min(rfrom, rto); s <= std::max(rfrom, rto); s++)
       if (s != kfrom && s != rfrom)
-          castlePath[c][cs] |= s;
+          ownCastleInfo.castlePath[c][cs] |= s;
 
   for (Square s = std::min(kfrom, kto); s <= std::max(kfrom, kto); s++)
       if (s != kfrom && s != rfrom)
-          castlePath[c][cs] |= s;
+          ownCastleInfo.castlePath[c][cs] |= s;
+}
+
+
+/// Position::set_key_filter() counts the keys of the states since the last
+/// irreversible move or null move, the ones is_draw() may compare to.
+
+void Position::set_key_filter() {
+
+  std::memset(keyFilter, 0, sizeof(keyFilter));
+
+  StateInfo* stp = st;
+  int e = std::min(st->rule50, st->pliesFromNull);
+
+  keyFilter[stp->key & (KeyFilterSize - 1)]++;
+
+  for (int i = 1; i <= e; i++)
+  {
+      stp = stp->previous;
+      keyFilter[stp->key & (KeyFilterSize - 1)]++;
+  }
 }
 
 
@@ -360,16 +452,16 @@ const string Position::fen() const {
   ss << (sideToMove == WHITE ? " w " : " b ");
 
   if (can_castle(WHITE_OO))
-      ss << (chess960 ? file_to_char(file_of(castle_rook_square(WHITE,  KING_SIDE)), false) : 'K');
+      ss << (is_chess960() ? file_to_char(file_of(castle_rook_square(WHITE,  KING_SIDE)), false) : 'K');
 
   if (can_castle(WHITE_OOO))
-      ss << (chess960 ? file_to_char(file_of(castle_rook_square(WHITE, QUEEN_SIDE)), false) : 'Q');
+      ss << (is_chess960() ? file_to_char(file_of(castle_rook_square(WHITE, QUEEN_SIDE)), false) : 'Q');
 
   if (can_castle(BLACK_OO))
-      ss << (chess960 ? file_to_char(file_of(castle_rook_square(BLACK,  KING_SIDE)),  true) : 'k');
+      ss << (is_chess960() ? file_to_char(file_of(castle_rook_square(BLACK,  KING_SIDE)),  true) : 'k');
 
   if (can_castle(BLACK_OOO))
-      ss << (chess960 ? file_to_char(file_of(castle_rook_square(BLACK, QUEEN_SIDE)),  true) : 'q');
+      ss << (is_chess960() ? file_to_char(file_of(castle_rook_square(BLACK, QUEEN_SIDE)),  true) : 'q');
 
   if (st->castleRights == CASTLES_NONE)
       ss << '-';
@@ -750,6 +842,11 @@ void Position::do_move(Move m, StateInfo& newSt, const CheckInfo& ci, bool moveI
   assert(piece_on(to) == NO_PIECE || color_of(piece_on(to)) == them || type_of(m) == CASTLE);
   assert(capture != KING);
 
+#ifdef USE_ATTACK_MAPS
+  Bitboard changed = changed_squares(m);
+  Bitboard sliders = remove_attacks(changed);
+#endif
+
   if (type_of(m) == CASTLE)
   {
       assert(pc == make_piece(us, KING));
@@ -818,9 +915,9 @@ void Position::do_move(Move m, StateInfo& newSt, const CheckInfo& ci, bool moveI
   }
 
   // Update castle rights if needed
-  if (st->castleRights && (castleRightsMask[from] | castleRightsMask[to]))
+  if (st->castleRights && (castleInfo->castleRightsMask[from] | castleInfo->castleRightsMask[to]))
   {
-      int cr = castleRightsMask[from] | castleRightsMask[to];
+      int cr = castleInfo->castleRightsMask[from] | castleInfo->castleRightsMask[to];
       k ^= Zobrist::castle[st->castleRights & cr];
       st->castleRights &= ~cr;
   }
@@ -882,6 +979,11 @@ void Position::do_move(Move m, StateInfo& newSt, const CheckInfo& ci, bool moveI
 
   // Update the key with the final value
   st->key = k;
+  keyFilter[k & (KeyFilterSize - 1)]++;
+
+#ifdef USE_ATTACK_MAPS
+  add_attacks(changed, sliders);
+#endif
 
   // Update checkers bitboard, piece must be already moved
   st->checkersBB = 0;
@@ -933,6 +1035,11 @@ void Position::undo_move(Move m) {
   assert(is_empty(from) || type_of(m) == CASTLE);
   assert(capture != KING);
 
+#ifdef USE_ATTACK_MAPS
+  Bitboard changed = changed_squares(m);
+  Bitboard sliders = remove_attacks(changed);
+#endif
+
   if (type_of(m) == PROMOTION)
   {
       PieceType promotion = promotion_type(m);
@@ -976,7 +1083,12 @@ void Position::undo_move(Move m) {
       put_piece(capsq, them, capture); // Restore the captured piece
   }
 
+#ifdef USE_ATTACK_MAPS
+  add_attacks(changed, sliders);
+#endif
+
   // Finally point our state pointer back to the previous state
+  keyFilter[st->key & (KeyFilterSize - 1)]--;
   st = st->previous;
   gamePly--;
 
@@ -984,6 +1096,78 @@ void Position::undo_move(Move m) {
 }
 
 
+#ifdef USE_ATTACK_MAPS
+
+/// Position::changed_squares() returns the squares whose content is changed by
+/// a move of the side to move: the from and to squares, the square of a pawn
+/// captured en passant, the king and rook squares of a castle.
+
+Bitboard Position::changed_squares(Move m) const {
+
+  Square from = from_sq(m), to = to_sq(m);
+  Bitboard b = SquareBB[from] | to;
+
+  if (type_of(m) == ENPASSANT)
+      b |= file_of(to) | rank_of(from);
+
+  else if (type_of(m) == CASTLE)
+  {
+      b |= relative_square(sideToMove, to > from ? SQ_G1 : SQ_C1);
+      b |= relative_square(sideToMove, to > from ? SQ_F1 : SQ_D1);
+  }
+
+  return b;
+}
+
+
+/// Position::remove_attacks() and Position::add_attacks() update the attack map
+/// around a change of the content of the 'changed' squares. Before the change
+/// remove_attacks() takes out of the map the attacks of the pieces on these
+/// squares and of the sliders attacking them, whose rays can be opened or
+/// closed, and returns the latter. After the change add_attacks() puts back the
+/// attacks of the same sliders and of the pieces now on the changed squares.
+/// Undoing a move is the same update with the board going the other way.
+
+Bitboard Position::remove_attacks(Bitboard changed) {
+
+  Bitboard sliders = 0, b = changed;
+
+  while (b)
+      sliders |= attackMap[pop_lsb(&b)];
+
+  sliders &= (pieces(BISHOP, ROOK) | pieces(QUEEN)) & ~changed;
+
+  b = sliders | (changed & pieces());
+
+  while (b)
+      toggle_attacks(pop_lsb(&b));
+
+  return sliders;
+}
+
+void Position::add_attacks(Bitboard changed, Bitboard sliders) {
+
+  Bitboard b = sliders | (changed & pieces());
+
+  while (b)
+      toggle_attacks(pop_lsb(&b));
+}
+
+
+/// Position::toggle_attacks() adds to or removes from the attack map the attacks
+/// of the piece on square s with the current occupancy.
+
+void Position::toggle_attacks(Square s) {
+
+  Bitboard b = attacks_from(piece_on(s), s, pieces());
+
+  while (b)
+      attackMap[pop_lsb(&b)] ^= s;
+}
+
+#endif
+
+
 /// Position::do_castle() is a helper used to do/undo a castling move. This
 /// is a bit tricky, especially in Chess960.
 
@@ -1017,6 +1201,7 @@ void Position::do_null_move(StateInfo& newSt) {
   }
 
   st->key ^= Zobrist::side;
+  keyFilter[st->key & (KeyFilterSize - 1)]++;
   prefetch((char*)TT.first_entry(st->key));
 
   st->rule50++;
@@ -1031,6 +1216,7 @@ void Position::undo_null_move() {
 
   assert(!checkers());
 
+  keyFilter[st->key & (KeyFilterSize - 1)]--;
   st = st->previous;
   sideToMove = ~sideToMove;
 }
@@ -1085,7 +1271,21 @@ int Position::see(Move m, int asymmThreshold) const {
 
   // Find all attackers to the destination square, with the moving piece
   // removed, but possibly an X-ray attacker added behind it.
+#ifdef USE_ATTACK_MAPS
+  // From the map only the sliders behind the moving piece, or behind a pawn
+  // captured en passant, are missing.
+  attackers = attackMap[to];
+
+  if (PseudoAttacks[BISHOP][to] & from)
+      attackers |= attacks_bb<BISHOP>(to, occupied) & pieces(BISHOP, QUEEN);
+
+  if ((PseudoAttacks[ROOK][to] & from) || type_of(m) == ENPASSANT)
+      attackers |= attacks_bb<ROOK>(to, occupied) & pieces(ROOK, QUEEN);
+
+  attackers &= occupied;
+#else
   attackers = attackers_to(to, occupied) & occupied;
+#endif
 
   // If the opponent has no attackers we are finished
   stm = ~stm;
@@ -1148,6 +1348,7 @@ void Position::clear() {
   std::memset(this, 0, sizeof(Position));
   startState.epSquare = SQ_NONE;
   st = &startState;
+  castleInfo = &ownCastleInfo;
 
   for (int i = 0; i < 8; i++)
       for (int j = 0; j < 16; j++)
@@ -1268,10 +1469,11 @@ bool Position::is_draw() const {
   if (st->rule50 > 99 && (!checkers() || MoveList<LEGAL>(*this).size()))
       return true;
 
-  // Draw by repetition?
+  // Draw by repetition? Scan the previous states only if some of them may
+  // have the same key.
   int i = 4, e = std::min(st->rule50, st->pliesFromNull);
 
-  if (i <= e)
+  if (i <= e && keyFilter[st->key & (KeyFilterSize - 1)] > 1)
   {
       StateInfo* stp = st->previous->previous;
 
@@ -1290,6 +1492,74 @@ bool Position::is_draw() const {
 }
 
 
+/// Position::has_game_cycle() tests whether the side to move has a move that
+/// reaches a position already seen since the last irreversible move, or if the
+/// opponent had a move earlier that returned to the current one. The positions
+/// at 3, 5, 7... plies back that differ from the current one by the move of a
+/// single piece are found in the cuckoo tables, the move is then possible if
+/// no piece stands between its squares. For a cycle starting before or at the
+/// root, 'ply' being the distance from the root, the repeated position must
+/// have occurred twice already, as in is_draw() at the root.
+
+bool Position::has_game_cycle(int ply) const {
+
+  int j, end = std::min(st->rule50, st->pliesFromNull);
+
+  if (end < 3)
+      return false;
+
+  Key originalKey = st->key;
+  StateInfo* stp = st->previous;
+
+  for (int i = 3; i <= end; i += 2)
+  {
+      stp = stp->previous->previous;
+
+      Key moveKey = originalKey ^ stp->key;
+
+      if (   (j = H1(moveKey), Cuckoo[j] == moveKey)
+          || (j = H2(moveKey), Cuckoo[j] == moveKey))
+      {
+          Move move = CuckooMove[j];
+          Square s1 = from_sq(move);
+          Square s2 = to_sq(move);
+
+          if (between_bb(s1, s2) & pieces())
+              continue;
+
+          if (ply > i)
+              return true;
+
+          // Before or at the root the move must be ours. The table stores the
+          // move and its reverse in the same slot, the moving piece is on the
+          // occupied square.
+          if (color_of(piece_on(is_empty(s1) ? s2 : s1)) != sideToMove)
+              continue;
+
+          // The repeated position must have a repetition itself, as in is_draw()
+          int k = 4, e = std::min(stp->rule50, stp->pliesFromNull);
+
+          if (k <= e)
+          {
+              StateInfo* prev = stp->previous->previous;
+
+              do {
+                  prev = prev->previous->previous;
+
+                  if (prev->key == stp->key)
+                      return true;
+
+                  k += 2;
+
+              } while (k <= e);
+          }
+      }
+  }
+
+  return false;
+}
+
+
 /// Position::flip() flips position with the white and black sides reversed. This
 /// is only useful for debugging especially for finding evaluation symmetry bugs.
 
@@ -1442,12 +1712,21 @@ bool Position::pos_is_ok(int* failedStep) const {
               if (!can_castle(cr))
                   continue;
 
-              if (  (castleRightsMask[king_square(c)] & cr) != cr
-                  || piece_on(castleRookSquare[c][s]) != make_piece(c, ROOK)
-                  || castleRightsMask[castleRookSquare[c][s]] != cr)
+              if (  (castleInfo->castleRightsMask[king_square(c)] & cr) != cr
+                  || piece_on(castle_rook_square(c, s)) != make_piece(c, ROOK)
+                  || castleInfo->castleRightsMask[castle_rook_square(c, s)] != cr)
                   return false;
           }
 
+#ifdef USE_ATTACK_MAPS
+  const bool debugAttackMap = all;
+
+  if ((*step)++, debugAttackMap)
+      for (Square s = SQ_A1; s <= SQ_H8; s++)
+          if (attackMap[s] != attackers_to(s, pieces()))
+              return false;
+#endif
+
   *step = 0;
   return true;
 }
@@ -67,6 +67,29 @@ struct StateInfo {
 const size_t StateCopySize64 = offsetof(StateInfo, key) / sizeof(uint64_t) + 1;
 
 
+/// The keys of the states of a position, from the root to the current one, are
+/// counted in KeyFilterSize buckets indexed by the low bits of the key. When the
+/// bucket of the current key holds only this one, the position is not repeated
+/// and is_draw() does not need to scan the previous states. The filter is not
+/// copied at a split point: the copy counts the states is_draw() can reach from
+/// its root only, those since the last irreversible move or null move.
+const int KeyFilterSize = 256;
+
+
+/// CastleInfo holds the castling geometry of a position: the castling rights
+/// lost by moving from or to each square, the rook squares and the squares
+/// that must be empty to castle. It is set up with the position and does not
+/// change as moves are made, so the copies made at a split point share the
+/// one of their master.
+
+struct CastleInfo {
+  int castleRightsMask[SQUARE_NB];
+  Square castleRookSquare[COLOR_NB][CASTLING_SIDE_NB];
+  Bitboard castlePath[COLOR_NB][CASTLING_SIDE_NB];
+  int chess960;
+};
+
+
 /// The position data structure. A position consists of the following data:
 ///
 ///    * For each piece type, a bitboard representing the squares occupied
@@ -92,7 +115,7 @@ const size_t StateCopySize64 = offsetof(StateInfo, key) / sizeof(uint64_t) + 1;
 class Position {
 public:
   Position() {}
-  Position(const Position& p, Thread* t) { *this = p; thisThread = t; }
+  Position(const Position& pos, Thread* th);
   Position(const std::string& f, bool c960, Thread* t) { set(f, c960, t); }
   Position& operator=(const Position&);
   static void init();
@@ -180,6 +203,7 @@ public:
   int64_t nodes_searched() const;
   void set_nodes_searched(int64_t n);
   bool is_draw() const;
+  bool has_game_cycle(int ply) const;
 
   // Position consistency check, for debugging
   bool pos_is_ok(int* failedStep = NULL) const;
@@ -189,6 +213,7 @@ private:
   // Initialization helpers (used while setting up a position)
   void clear();
   void set_castle_right(Color c, Square rfrom);
+  void set_key_filter();
 
   // Helper functions
   void do_castle(Square kfrom, Square kto, Square rfrom, Square rto);
@@ -197,6 +222,14 @@ private:
   void remove_piece(Square s, Color c, PieceType pt);
   void move_piece(Square from, Square to, Color c, PieceType pt);
 
+#ifdef USE_ATTACK_MAPS
+  // Incremental update of the attack map
+  Bitboard changed_squares(Move m) const;
+  Bitboard remove_attacks(Bitboard changed);
+  void add_attacks(Bitboard changed, Bitboard sliders);
+  void toggle_attacks(Square s);
+#endif
+
   // Computing hash keys from scratch (for initialization and debugging)
   Key compute_key() const;
   Key compute_pawn_key() const;
@@ -210,21 +243,32 @@ private:
   Piece board[SQUARE_NB];
   Bitboard byTypeBB[PIECE_TYPE_NB];
   Bitboard byColorBB[COLOR_NB];
+#ifdef COMPACT_TABLES
+  uint8_t pieceCount[COLOR_NB][PIECE_TYPE_NB];
+  Square pieceList[COLOR_NB][PIECE_TYPE_NB][16];
+  uint8_t index[SQUARE_NB];
+#else
   int pieceCount[COLOR_NB][PIECE_TYPE_NB];
   Square pieceList[COLOR_NB][PIECE_TYPE_NB][16];
   int index[SQUARE_NB];
+#endif
+
+#ifdef USE_ATTACK_MAPS
+  Bitboard attackMap[SQUARE_NB]; // The pieces attacking each square
+#endif
 
   // Other info
-  int castleRightsMask[SQUARE_NB];
-  Square castleRookSquare[COLOR_NB][CASTLING_SIDE_NB];
-  Bitboard castlePath[COLOR_NB][CASTLING_SIDE_NB];
-  StateInfo startState;
   int64_t nodes;
   int gamePly;
   Color sideToMove;
   Thread* thisThread;
   StateInfo* st;
-  int chess960;
+  const CastleInfo* castleInfo;
+
+  // Not copied by the split point constructor, must be the last members
+  StateInfo startState;
+  CastleInfo ownCastleInfo;
+  uint8_t keyFilter[KeyFilterSize];
 };
 
 inline int64_t Position::nodes_searched() const {
@@ -300,11 +344,11 @@ inline int Position::can_castle(Color c) const {
 }
 
 inline bool Position::castle_impeded(Color c, CastlingSide s) const {
-  return byTypeBB[ALL_PIECES] & castlePath[c][s];
+  return byTypeBB[ALL_PIECES] & castleInfo->castlePath[c][s];
 }
 
 inline Square Position::castle_rook_square(Color c, CastlingSide s) const {
-  return castleRookSquare[c][s];
+  return castleInfo->castleRookSquare[c][s];
 }
 
 template<PieceType Pt>
@@ -325,7 +369,11 @@ inline Bitboard Position::attacks_from(Piece p, Square s) const {
 }
 
 inline Bitboard Position::attackers_to(Square s) const {
+#ifdef USE_ATTACK_MAPS
+  return attackMap[s];
+#else
   return attackers_to(s, byTypeBB[ALL_PIECES]);
+#endif
 }
 
 inline Bitboard Position::checkers() const {
@@ -392,7 +440,7 @@ inline bool Position::pawn_on_7th(Color c) const {
 }
 
 inline bool Position::is_chess960() const {
-  return chess960;
+  return castleInfo->chess960;
 }
 
 inline bool Position::is_capture_or_promotion(Move m) const {
@@ -25,6 +25,7 @@
 #include <sstream>
 
 #include "book.h"
+#include "dgt.h"
 #include "evaluate.h"
 #include "movegen.h"
 #include "movepick.h"
@@ -34,7 +35,6 @@
 #include "thread.h"
 #include "tt.h"
 #include "ucioption.h"
-#include "dgtnix.h"
 
 namespace Search {
 
@@ -45,7 +45,7 @@ namespace Search {
   Color RootColor;
   Time::point SearchTime;
   StateStackPtr SetupStates;
-  Uci_PV_DGT UciPvDgt;
+  PVSnapshot LastPV;
 }
 
 using std::string;
@@ -161,29 +161,6 @@ void Search::init() {
 }
 
 
-/// Search::perft() is our utility to verify move generation. All the leaf nodes
-/// up to the given depth are generated and counted and the sum returned.
-
-static size_t perft(Position& pos, Depth depth) {
-
-  StateInfo st;
-  size_t cnt = 0;
-  CheckInfo ci(pos);
-  const bool leaf = depth == 2 * ONE_PLY;
-
-  for (MoveList<LEGAL> it(pos); *it; ++it)
-  {
-      pos.do_move(*it, st, ci, pos.move_gives_check(*it, ci));
-      cnt += leaf ? MoveList<LEGAL>(pos).size() : ::perft(pos, depth - ONE_PLY);
-      pos.undo_move(*it);
-  }
-  return cnt;
-}
-
-size_t Search::perft(Position& pos, Depth depth) {
-  return depth > ONE_PLY ? ::perft(pos, depth) : MoveList<LEGAL>(pos).size();
-}
-
 /// Search::think() is the external interface to Stockfish's search, and is
 /// called by the main thread when the program receives the UCI 'go' command. It
 /// searches from RootPos and at the end prints the "bestmove" to output.
@@ -290,11 +267,10 @@ finalize:
       RootPos.this_thread()->wait_for(Signals.stop);
   }
 
+  // Needed by picochess to know when the search is finished
+  Signals.stop = true;
+  DGT::Engine.search_finished();
 
-    //needed by picochess to know when the search is finished
-    Signals.stop=true;   
-    sem_post(&dgtnixEventSemaphore); 
-    
   // Best move could be MOVE_NONE when searching on a stalemate position
   sync_cout << "bestmove " << move_to_uci(RootMoves[0].pv[0], RootPos.is_chess960())
             << " ponder "  << move_to_uci(RootMoves[0].pv[1], RootPos.is_chess960())
@@ -554,6 +530,16 @@ namespace {
         if (Signals.stop || pos.is_draw() || ss->ply > MAX_PLY)
             return DrawValue[pos.side_to_move()];
 
+        // Step 2a. Upcoming repetition. If we can repeat a position with a move,
+        // or the opponent could have done it, we can count on at least a draw.
+        if (   alpha < DrawValue[pos.side_to_move()]
+            && pos.has_game_cycle(ss->ply))
+        {
+            alpha = DrawValue[pos.side_to_move()];
+            if (alpha >= beta)
+                return alpha;
+        }
+
         // Step 3. Mate distance pruning. Even if we mate at the next move our score
         // would be at best mate_in(ss->ply+1), but if alpha is already bigger because
         // a shorter mate was found upward in the tree then there is no need to search
@@ -1149,10 +1135,6 @@ moves_loop: // When in check and at SpNode search starts from here
     bool givesCheck, evasionPrunable;
     Depth ttDepth;
 
-    // To flag BOUND_EXACT a node with eval above alpha and no available moves
-    if (PvNode)
-        oldAlpha = alpha;
-
     ss->currentMove = bestMove = MOVE_NONE;
     ss->ply = (ss-1)->ply + 1;
 
@@ -1160,6 +1142,19 @@ moves_loop: // When in check and at SpNode search starts from here
     if (pos.is_draw() || ss->ply > MAX_PLY)
         return DrawValue[pos.side_to_move()];
 
+    // Check for a move that repeats a position, as in search()
+    if (   alpha < DrawValue[pos.side_to_move()]
+        && pos.has_game_cycle(ss->ply))
+    {
+        alpha = DrawValue[pos.side_to_move()];
+        if (alpha >= beta)
+            return alpha;
+    }
+
+    // To flag BOUND_EXACT a node with eval above alpha and no available moves
+    if (PvNode)
+        oldAlpha = alpha;
+
     // Decide whether or not to include checks, this fixes also the type of
     // TT entry depth that we are going to use. Note that in qsearch we use
     // only two types of depth in TT: DEPTH_QS_CHECKS or DEPTH_QS_NO_CHECKS.
@@ -1536,7 +1531,6 @@ moves_loop: // When in check and at SpNode search starts from here
   string uci_pv(const Position& pos, int depth, Value alpha, Value beta) {
 
     std::stringstream s;
-    std::stringstream pv;
     Time::point elapsed = Time::now() - SearchTime + 1;
     size_t uciPVSize = std::min((size_t)Options["MultiPV"], RootMoves.size());
     int selDepth = 0;
@@ -1569,33 +1563,27 @@ moves_loop: // When in check and at SpNode search starts from here
           << " multipv "   << i + 1
           << " pv";
         
-        UciPvDgt.depth = d;
-        UciPvDgt.seldepth = selDepth;
-        // Dont report alpha/beta score
-        
-        // Convert score to from white's perspective
-        if (Search::RootColor == BLACK) {
-            v*=-1;
-        }
-        
-        UciPvDgt.score = score_to_uci(v);
-        UciPvDgt.nodes = pos.nodes_searched();
-        UciPvDgt.nps = pos.nodes_searched() * 1000 / elapsed;
-        UciPvDgt.elapsed = elapsed;
-        UciPvDgt.multipv = i + 1;
-
-        UciPvDgt.pv = " ";
-        UciPvDgt.bestMove = RootMoves[0].pv[0];
-        UciPvDgt.ponderMove = RootMoves[0].pv[1];
-
         for (size_t j = 0; RootMoves[i].pv[j] != MOVE_NONE; j++)
-          {
-            pv << " " << move_to_uci(RootMoves[i].pv[j], pos.is_chess960());
-//            s <<  " " << move_to_uci(RootMoves[i].pv[j], pos.is_chess960());
-          }
+            s <<  " " << move_to_uci(RootMoves[i].pv[j], pos.is_chess960());
+
+        // Publish the main line for the DGT displays, without alpha/beta bounds
+        if (i == 0)
+        {
+            PVInfo pi;
+            pi.depth = d;
+            pi.seldepth = selDepth;
+            pi.score = RootColor == WHITE ? v : -v;
+            pi.nodes = pos.nodes_searched();
+            pi.nps = pos.nodes_searched() * 1000 / elapsed;
+            pi.elapsed = elapsed;
+            pi.pvLength = 0;
+
+            for ( ; pi.pvLength < MAX_PLY && RootMoves[0].pv[pi.pvLength] != MOVE_NONE; pi.pvLength++)
+                pi.pv[pi.pvLength] = RootMoves[0].pv[pi.pvLength];
+
+            LastPV.publish(pi);
+        }
     }
-    s << pv.rdbuf();
-    UciPvDgt.pv = pv.str();
     return s.str();
   }
 
@@ -1662,6 +1650,39 @@ void RootMove::insert_pv_in_tt(Position& pos) {
 }
 
 
+/// PVSnapshot::publish() and PVSnapshot::read() implement the sequence lock.
+/// The version is odd while the writer copies the data, so a reader retries
+/// when it sees an odd version or when the version changed during its copy.
+
+void PVSnapshot::publish(const PVInfo& pi) {
+
+  version++;
+  memory_barrier();
+  info = pi;
+  memory_barrier();
+  version++;
+}
+
+bool PVSnapshot::read(PVInfo& pi) const {
+
+  for (int attempt = 0; attempt < 4; attempt++)
+  {
+      unsigned v = version;
+      memory_barrier();
+
+      if (v & 1)
+          continue;
+
+      pi = info;
+      memory_barrier();
+
+      if (version == v)
+          return true;
+  }
+  return false;
+}
+
+
 /// Thread::idle_loop() is where the thread is parked when it has no work to do
 
 void Thread::idle_loop() {
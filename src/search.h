@@ -34,18 +34,38 @@ struct SplitPoint;
 namespace Search {
     
     
- struct Uci_PV_DGT {
-    int depth;
-    int seldepth;
-    std::string score;
-    int64_t nodes;
-    double nps;
-    Time::point elapsed;
-    size_t multipv;
-    std::string pv;
-    Move bestMove;
-    Move ponderMove;
- };
+/// PVInfo is a copy of the main line last sent to the GUI, used by the DGT
+/// clock displays and the PGN comments. The score is from White's point of view.
+
+struct PVInfo {
+  Move best_move() const { return pvLength > 0 ? pv[0] : MOVE_NONE; }
+  Move ponder_move() const { return pvLength > 1 ? pv[1] : MOVE_NONE; }
+
+  int depth, seldepth;
+  Value score;
+  int64_t nodes, nps;
+  Time::point elapsed;
+  int pvLength;
+  Move pv[MAX_PLY];
+};
+
+
+/// PVSnapshot publishes the last PVInfo of the search as a sequence lock. The
+/// search, the only writer, never waits for the readers and a reader copies
+/// the data again if a new version was published meanwhile, giving up after a
+/// few attempts, so that a display thread always gets a consistent copy or
+/// none at all.
+
+class PVSnapshot {
+public:
+  PVSnapshot() : version(0) { std::memset(&info, 0, sizeof(PVInfo)); }
+  void publish(const PVInfo& pi);
+  bool read(PVInfo& pi) const;
+
+private:
+  volatile unsigned version;
+  PVInfo info;
+};
 
 /// The Stack struct keeps track of the information we need to remember from
 /// nodes shallower and deeper in the tree during the search. Each search thread
@@ -118,9 +138,8 @@ extern Time::point SearchTime;
 extern StateStackPtr SetupStates;
 
 extern void init();
-extern size_t perft(Position& pos, Depth depth);
 extern void think();
-extern Uci_PV_DGT UciPvDgt;
+extern PVSnapshot LastPV;
 
 } // namespace Search
 
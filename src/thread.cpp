@@ -29,31 +29,21 @@ using namespace Search;
 
 ThreadPool Threads; // Global object
 
-namespace {
+// start_routine() is the C function which is called when a new thread
+// is launched. It is a wrapper to the virtual function idle_loop().
 
- // start_routine() is the C function which is called when a new thread
- // is launched. It is a wrapper to the virtual function idle_loop().
+extern "C" { long start_routine(ThreadBase* th) { th->idle_loop(); return 0; } }
 
- extern "C" { long start_routine(ThreadBase* th) { th->idle_loop(); return 0; } }
 
+// delete_thread() asks the thread to exit, joins and deletes it. Must be called
+// outside the ThreadBase d'tor because the object shall be fully valid while
+// joining.
 
- // Helpers to launch a thread after creation and joining before delete. Must be
- // outside Thread c'tor and d'tor because object shall be fully initialized
- // when start_routine (and hence virtual idle_loop) is called and when joining.
-
- template<typename T> T* new_thread() {
-   T* th = new T();
-   thread_create(th->handle, start_routine, th); // Will go to sleep
-   return th;
- }
-
- void delete_thread(ThreadBase* th) {
-   th->exit = true; // Search must be already finished
-   th->notify_one();
-   thread_join(th->handle); // Wait for thread termination
-   delete th;
- }
-
+void delete_thread(ThreadBase* th) {
+  th->exit = true; // Search must be already finished
+  th->notify_one();
+  thread_join(th->handle); // Wait for thread termination
+  delete th;
 }
 
 
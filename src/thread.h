@@ -104,6 +104,21 @@ struct ThreadBase {
 };
 
 
+/// Helpers to launch a thread after creation and joining before delete. Must be
+/// outside ThreadBase c'tor and d'tor because object shall be fully initialized
+/// when start_routine (and hence virtual idle_loop) is called and when joining.
+
+extern "C" long start_routine(ThreadBase* th);
+
+template<typename T> T* new_thread() {
+  T* th = new T();
+  thread_create(th->handle, start_routine, th); // Will go to sleep
+  return th;
+}
+
+void delete_thread(ThreadBase* th);
+
+
 /// Thread struct keeps together all the thread related stuff like locks, state
 /// and especially split points. We also use per-thread pawn and material hash
 /// tables so that once we get a pointer to an entry its life time is unlimited
@@ -34,6 +34,19 @@
 /// -DUSE_POPCNT  | Add runtime support for use of popcnt asm-instruction. Works
 ///               | only in 64-bit mode. For compiling requires hardware with
 ///               | popcnt support.
+///
+/// -DUSE_CPUID   | Detect at startup whether the CPU has the popcnt and pext
+///               | (BMI2) asm-instructions and use them if so. Works only in
+///               | 64-bit mode on x86, the same executable runs on any CPU.
+///
+/// -DCOMPACT_TABLES | Use smaller lookup tables and piece indices, computing
+///                  | between_bb() and the king-pawn distance instead of
+///                  | reading them from a table. Faster on CPUs with small
+///                  | caches, as the ARM of the Raspberry Pi.
+///
+/// -DUSE_ATTACK_MAPS | Keep in Position the attackers of each square, updated
+///                   | as moves are made and used by attackers_to() and see(),
+///                   | instead of computing them when needed.
 
 #include <cassert>
 #include <cctype>
@@ -50,10 +63,14 @@
 #  define USE_BSFQ
 #endif
 
-#if defined(USE_POPCNT) && defined(_MSC_VER) && defined(__INTEL_COMPILER)
+#if (defined(USE_POPCNT) || defined(USE_CPUID)) && defined(_MSC_VER) && defined(__INTEL_COMPILER)
 #  include <nmmintrin.h> // Intel header for _mm_popcnt_u64() intrinsic
 #endif
 
+#if defined(USE_CPUID) && defined(_MSC_VER)
+#  include <immintrin.h> // Intel and Microsoft header for _pext_u64() intrinsic
+#endif
+
 #  if !defined(NO_PREFETCH) && (defined(__INTEL_COMPILER) || defined(_MSC_VER))
 #   include <xmmintrin.h> // Intel and Microsoft header for _mm_prefetch()
 #  endif
@@ -17,13 +17,17 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <cstdlib>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
 #include <string>
 
+#include "dgt.h"
+#include "dgttrace.h"
 #include "evaluate.h"
 #include "notation.h"
+#include "perft.h"
 #include "position.h"
 #include "search.h"
 #include "thread.h"
@@ -82,18 +86,48 @@ void UCI::loop(const string& args) {
           else
               Search::Limits.ponder = false;
       }
-      else if (token == "perft" && (is >> token)) // Read perft depth
+      else if (token == "perft" && (is >> token)) // Read perft depth or 'suite'
       {
-          stringstream ss;
+          if (token == "suite") // Read EPD file name and maximum depth
+          {
+              string fileName = (is >> token) ? token : "perftsuite.epd";
+              int maxDepth = (is >> token) ? atoi(token.c_str()) : 6;
 
-          ss << Options["Hash"]    << " "
-             << Options["Threads"] << " " << token << " current perft";
+              Perft::suite(fileName, maxDepth);
+          }
+          else
+          {
+              Time::point elapsed = Time::now();
+              uint64_t cnt = Perft::perft(pos, atoi(token.c_str()), true);
+              elapsed = Time::now() - elapsed + 1; // Assure positive to avoid a 'divide by zero'
+
+              sync_cout << "\n==========================="
+                        << "\nTotal time (ms) : " << elapsed
+                        << "\nNodes searched  : " << cnt
+                        << "\nNodes/second    : " << 1000 * cnt / elapsed << sync_endl;
+          }
+      }
+      else if (token == "dgt" && (is >> token)) // Read the USB ports, one per board
+      {
+          string ports = token;
+          while (is >> token)
+              ports += " " + token;
 
-          benchmark(pos, ss);
+          DGT::loop(ports);
       }
-      else if (token == "dgt" && (is >> token)) // Read USB port
+      else if (token == "latency") // Board to clock latencies of the DGT moves
       {
-          DGT::loop(token);
+          if (is >> token && token == "reset")
+              DGT::Latency.reset();
+          else
+              sync_cout << DGT::Latency.report() << sync_endl;
+      }
+      else if (token == "kpk") // Write the KPK bitbase, by default to kpkbitbase.h
+      {
+          string fileName = is >> token ? token : "kpkbitbase.h";
+
+          if (!Bitbases::write_kpk(fileName))
+              sync_cout << "Cannot write " << fileName << sync_endl;
       }
       else if (token == "key")
           sync_cout << hex << uppercase << setfill('0')
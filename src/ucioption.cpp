@@ -75,6 +75,7 @@ void init(OptionsMap& o) {
   o["Idle Threads Sleep"]          = Option(true);
   o["Hash"]                        = Option(32, 1, 8192, on_hash_size);
   o["Clear Hash"]                  = Option(on_clear_hash);
+  o["Perft Hash"]                  = Option(16, 1, 8192);
   o["Ponder"]                      = Option(true);
   o["OwnBook"]                     = Option(false);
   o["MultiPV"]                     = Option(1, 1, 500);
@@ -86,6 +87,12 @@ void init(OptionsMap& o) {
   o["Slow Mover"]                  = Option(50, 10, 1000);
   o["UCI_Chess960"]                = Option(false);
   o["UCI_AnalyseMode"]             = Option(false, on_eval);
+  o["DGT Settle Time"]             = Option(250, 0, 2000);
+  o["DGT Speculative Search"]      = Option(true);
+  o["DGT Ponder Candidates"]       = Option(1, 1, 4);
+  o["DGT Background Analysis"]     = Option(0, 0, 4);
+  o["DGT Latency Log"]             = Option(false);
+  o["DGT Latency Log Filename"]    = Option("latency.log");
 }
 
 
@@ -64,11 +64,6 @@ void loop(const std::string&);
 
 } // namespace UCI
 
-namespace DGT
-{
-	void loop(const std::string&);
-}
-
 extern UCI::OptionsMap Options;
 
 #endif // #ifndef UCIOPTION_H_INCLUDED